@@ -20,11 +20,13 @@ extern "C" {
 #include <stdio.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
 
 typedef unsigned short Move;
 typedef unsigned char Square;
 typedef unsigned char Castle;
 typedef enum { BLACK, WHITE, BOTH } Player;
+typedef unsigned long long Bitboard;
 
 /*
  * from square:  6 bits (2^6 = 64)
@@ -55,6 +57,22 @@ typedef enum { BLACK, WHITE, BOTH } Player;
 #define NO_MOVE ((Move)0)
 #define MAX_LENGTH_FEN 0x80
 #define MAX_VALID_MOVES 0x100
+#define MAX_PLY 0x400 // records of a full game's undo stack, see position_set_history
+#define PERFT_MAX_THREADS 64
+#define PERFT_MAX_SPLIT_PLY 8
+#define PERFT_DEFAULT_SPLIT_PLY 2
+#define PERFT_TABLE_BUCKET_SIZE 4 // entries per 64-byte bucket
+#define PERFT_TABLE_MIN_DEPTH 2   // depth 1 is bulk counted, cheaper than a probe
+#define PERFT_TABLE_NO_SWITCH 0xD6E8FEB86659FD93ULL // xored into the keys of perft that does not switch players, its counts differ
+#define PERFT_TABLE_VERSION 2     // bump when the file layout or the meaning of an entry changes
+#define PERFT_FRONTIER_DEFAULT_PLY 5
+#define SEARCH_MAX_DEPTH 64
+#define SEARCH_MAX_PLY 128      // longest line a search follows, check extensions included
+#define SEARCH_MATE 32000       // being mated in `n` plies scores -(SEARCH_MATE - n)
+#define SEARCH_INFINITE 32767
+#define SEARCH_IS_MATE(score) (ABS(score) >= SEARCH_MATE - SEARCH_MAX_PLY)
+#define SEARCH_TABLE_BUCKET_SIZE 4 // entries per 64-byte bucket
+#define SEARCH_MAX_THREADS 64
 
 #define GET_ROW(square) ((square) >> 3) // square / 8
 #define GET_COL(square) ((square) & 7)  // square % 8
@@ -65,6 +83,19 @@ typedef enum { BLACK, WHITE, BOTH } Player;
 #define IS_WHITE_PIECE(piece) ((piece) >= 'A' && (piece) <= 'Z') // (isupper(piece))
 #define IS_BLACK_PIECE(piece) ((piece) >= 'a' && (piece) <= 'z') // (islower(piece))
 
+#define NO_SQUARE ((Square)64)
+
+#define SQUARE_BB(square) (1ULL << (square))
+#define POP_COUNT(bb) (__builtin_popcountll(bb))
+#define LSB(bb) ((Square)__builtin_ctzll(bb))     // undefined for an empty bitboard
+#define POP_LSB(bb) ((bb) &= (bb) - 1)
+
+#define FILE_A_BB 0x0101010101010101ULL
+#define FILE_B_BB 0x0202020202020202ULL
+#define FILE_G_BB 0x4040404040404040ULL
+#define FILE_H_BB 0x8080808080808080ULL
+#define ROW_BB(row) (0xFFULL << ((row) * 8))
+
 #define SWITCH_PLAYER(player) ((player) == WHITE ? BLACK : WHITE)
 #define CHECK_VALID_PLAYER(player) ((player) == WHITE || (player) == BLACK || (player) == BOTH)
 #define IS_INVALID_PROMOTION_PIECE(piece) ((piece) > QUEEN)
@@ -98,6 +129,217 @@ typedef enum { BLACK, WHITE, BOTH } Player;
 
 enum { NORMAL = 0, PROMOTION = 1, CASTLE = 2, EN_PASSANT = 3, };
 enum { KNIGHT = 0, BISHOP = 1, ROOK = 2, QUEEN = 3 };
+enum { PIECE_PAWN = 0, PIECE_KNIGHT = 1, PIECE_BISHOP = 2, PIECE_ROOK = 3, PIECE_QUEEN = 4, PIECE_KING = 5 };
+
+#define PROMOTION_TO_PIECE(promotion) ((promotion) + 1) // KNIGHT -> PIECE_KNIGHT, ..., QUEEN -> PIECE_QUEEN
+
+// Only valid for piece characters, empty square (' ') maps to PIECE_PAWN
+#define PIECE_TYPE(piece) (PIECE_TYPES[(unsigned char)(piece)])
+#define PIECE_PLAYER(piece) (IS_WHITE_PIECE(piece) ? WHITE : BLACK)
+#define PIECE_CHAR(player, type) (PIECE_CHARS[(player)][(type)])
+
+static const unsigned char PIECE_TYPES[128] = {
+	['P'] = PIECE_PAWN, ['N'] = PIECE_KNIGHT, ['B'] = PIECE_BISHOP, ['R'] = PIECE_ROOK, ['Q'] = PIECE_QUEEN, ['K'] = PIECE_KING,
+	['p'] = PIECE_PAWN, ['n'] = PIECE_KNIGHT, ['b'] = PIECE_BISHOP, ['r'] = PIECE_ROOK, ['q'] = PIECE_QUEEN, ['k'] = PIECE_KING,
+};
+
+static const char PIECE_CHARS[2][6] = {
+	{ 'p', 'n', 'b', 'r', 'q', 'k' }, // BLACK
+	{ 'P', 'N', 'B', 'R', 'Q', 'K' }, // WHITE
+};
+
+// Everything position_push changes that can not be recomputed from the move itself
+typedef struct
+{
+	Move move;
+	char captured_piece;
+	Castle castle;
+	Square en_passant;
+	unsigned short halfmove_clock;
+	Bitboard hash;
+} PositionUndo;
+
+/*
+ * Bitboard-backed position, bit `n` of every bitboard is square `n` of the char board (0 -> a8, 63 -> h1).
+ * The `board` member is a compatibility view that is kept in sync by position_make_move/position_undo_move,
+ * so every function taking `char board[64]` can be called with `position.board`.
+ */
+typedef struct
+{
+	char board[64];
+	Bitboard pieces[2][6]; // [player][piece type]
+	Bitboard occupied[3];  // [BLACK], [WHITE], [BOTH]
+	Square king_square[2]; // [player], NO_SQUARE without a king
+	Bitboard key;          // Zobrist key of the pieces, see position_hash for the full key
+
+	// Game state, kept current by position_set/position_push/position_pop only, the undo stack is owned by the caller
+	Player player;                 // side to move
+	Castle castle;                 // updated from the squares a move touches, no update_castle rescan
+	Square en_passant;             // square skipped by the last double pawn push, NO_SQUARE otherwise
+	unsigned short halfmove_clock; // moves since the last capture or pawn move
+	Bitboard hash;                 // Zobrist key of the pieces and the state above
+	unsigned short ply;            // records on the undo stack
+	unsigned short history_size;   // records `history` has room for
+	PositionUndo* history;         // undo stack of position_push, NULL until position_set_history
+} Position;
+
+/*
+ * Everything needed to tell whether a move of `player` gives check, computed once per node by
+ * position_check_info so position_gives_check is a couple of table lookups per move.
+ */
+typedef struct
+{
+	Bitboard check_squares[6]; // [piece type] squares a piece of that type gives check from
+	Bitboard discovered;       // own pieces that uncover a check by leaving the line to the enemy king
+	Square king_square;        // enemy king, NO_SQUARE without one
+	Player player;
+} CheckInfo;
+
+// Captures include every promotion and en passant, quiet moves include castling
+enum { GENERATE_CAPTURES = 1, GENERATE_QUIETS = 2, GENERATE_ALL = 3, GENERATE_EVASIONS = 4 };
+
+enum
+{
+	MOVE_STAGE_HASH_MOVE,
+	MOVE_STAGE_GENERATE_CAPTURES,
+	MOVE_STAGE_CAPTURES,
+	MOVE_STAGE_KILLERS,
+	MOVE_STAGE_GENERATE_QUIETS,
+	MOVE_STAGE_QUIETS,
+	MOVE_STAGE_DONE
+};
+
+/*
+ * Staged move generator: hash move, captures and promotions (best victim first), killers, then quiet moves.
+ * Every stage is generated only when the previous one is exhausted, so consumers that stop after the
+ * first few moves never pay for the rest. `player` has to be WHITE or BLACK.
+ */
+typedef struct
+{
+	Position* position;
+	Player player;
+	Castle castle;
+	Move last_move;
+	Move hash_move;
+	Move killers[2];
+	Move moves[MAX_VALID_MOVES];
+	short scores[MAX_VALID_MOVES];
+	unsigned char count;
+	unsigned char index;
+	unsigned char stage;
+} MoveGenerator;
+
+typedef struct
+{
+	Bitboard key;            // position key ^ data, a torn or concurrent write never verifies
+	unsigned long long data; // subtree count in the low 56 bits, remaining depth in the high 8 bits
+} PerftEntry;
+
+/*
+ * Fixed-size table of perft subtree counts keyed by position hash and remaining depth.
+ * Replacement is depth-preferred per bucket: a new count takes a free or matching slot, otherwise
+ * it evicts the shallowest entry of its bucket unless every entry there is deeper.
+ *
+ * perft_table_open puts the entries in a shared memory-mapped file instead, so counts survive the process
+ * and are shared by every process that opens the same file.
+ */
+typedef struct
+{
+	PerftEntry* entries;
+	size_t bucket_count; // power of two
+	void* mapping;       // file header and entries of an opened table, NULL for perft_table_init
+	size_t mapping_size;
+	unsigned long long probes;
+	unsigned long long hits;
+	unsigned long long stores;
+	unsigned long long replacements;
+} PerftTable;
+
+// Filled per worker by perft_parallel/position_perft_parallel
+typedef struct
+{
+	unsigned long long nodes; // leaf nodes counted by this thread
+	unsigned long long tasks; // subtrees searched, stolen ones included
+	unsigned long long steals;
+	double seconds;           // from start to running out of work
+	double nps;               // nodes / seconds
+} PerftThreadStats;
+
+// Per ply counters of perft_stats/position_perft_stats, the columns of the chessprogramming.org perft results tables
+typedef struct
+{
+	unsigned long long nodes;
+	unsigned long long captures;          // en passant included
+	unsigned long long en_passants;
+	unsigned long long castles;
+	unsigned long long promotions;
+	unsigned long long checks;
+	unsigned long long discovered_checks; // a piece other than the moved one gives the only check
+	unsigned long long double_checks;
+	unsigned long long checkmates;
+} PerftStats;
+
+// Called by perft_divide/position_perft_divide once per root move, as soon as its subtree is counted
+typedef void (*PerftDivideCallback)(const Move move, const unsigned long long nodes, const double seconds, void* data);
+
+// Handed to the progress callback of perft_journal/position_perft_journal after every finished work unit
+typedef struct
+{
+	unsigned int units_done;  // resumed ones included
+	unsigned int unit_count;
+	unsigned int units_resumed;
+	unsigned long long nodes; // counted so far, resumed ones included
+	double seconds;           // since this run started
+	double eta;               // seconds left at the pace of this run, negative until it finished a unit
+} PerftProgress;
+
+typedef void (*PerftProgressCallback)(const PerftProgress* progress, void* data);
+
+// Filled by perft_frontier/position_perft_frontier
+typedef struct
+{
+	unsigned int frontier_ply;
+	unsigned long long paths;     // move sequences reaching the frontier, the perft of `frontier_ply`
+	unsigned long long positions; // frontier positions counted from, every path to them shares the count
+	unsigned long long spilled;   // entries written to temporary files over all plies
+} PerftFrontierStats;
+
+// A zero depth or nodes is no limit, at least one of them should be set
+typedef struct
+{
+	int depth;                // deepest iteration, up to SEARCH_MAX_DEPTH
+	unsigned long long nodes; // the search stops once it visited this many nodes, all threads together
+	unsigned int threads;     // 0 or 1 searches on the calling thread only, more need a SearchTable
+} SearchLimits;
+
+typedef struct
+{
+	Move best_move;           // NO_MOVE without a legal move
+	int score;                // centipawns for the side to move, see SEARCH_MATE
+	int depth;                // last completed iteration, 0 when the limits stopped the first one
+	unsigned long long nodes; // all threads together
+	double seconds;
+	Move pv[SEARCH_MAX_PLY];  // principal variation of the last completed iteration
+	unsigned char pv_length;
+} SearchResult;
+
+typedef struct
+{
+	Bitboard key;             // position key ^ data, a torn or concurrent write never verifies
+	unsigned long long data;  // move, score, depth, bound and age, see SEARCH_ENTRY_*
+} SearchEntry;
+
+/*
+ * Transposition table of the search. Any number of threads can probe and store at the same time without
+ * locks, an entry that was half written by another thread simply does not verify. Replacement prefers
+ * entries of earlier searches, then the shallowest one of the bucket.
+ */
+typedef struct
+{
+	SearchEntry* entries;
+	size_t bucket_count;      // power of two
+	unsigned char age;        // bumped by every position_search
+} SearchTable;
 
 static const char INITIAL_BOARD[64] = {
 	'r', 'n', 'b', 'q', 'k', 'b', 'n', 'r',
@@ -120,8 +362,18 @@ static const char INITIAL_BOARD[64] = {
 #define isInCheck             is_in_check
 #define isCheckmate           is_checkmate
 #define isStalemate           is_stalemate
-#define addMove               add_move
 #define generateValidMoves    generate_valid_moves
+#define perftParallel         perft_parallel
+#define perftHashed           perft_hashed
+#define perftDivide           perft_divide
+#define perftJournal          perft_journal
+#define perftFrontier         perft_frontier
+#define perftStats            perft_stats
+#define searchBestMove        search_best_move
+#define generateCaptureMoves  generate_capture_moves
+#define generateQuietMoves    generate_quiet_moves
+#define generateEvasionMoves  generate_evasion_moves
+#define countValidMoves       count_valid_moves
 #define isAttacked            is_attacked
 #define canEnPassant          can_en_passant
 #define canCastle             can_castle
@@ -133,9 +385,56 @@ static const char INITIAL_BOARD[64] = {
 #define moveToPGN             move_to_PGN
 #define isMoveInValidMoves    is_move_in_valid_moves
 #define isLegalMove           is_legal_move
+#define moveToUCI             move_to_UCI
+#define parseFen              parse_fen
 #define fenToBoard            fen_to_board
 #define boardToFen            board_to_fen
 
+#define boardPieceMask               board_piece_mask
+#define boardPlayerMask              board_player_mask
+#define initAttackTables             init_attack_tables
+#define positionInit                 position_init
+#define positionSet                  position_set
+#define positionSetHistory           position_set_history
+#define positionPush                 position_push
+#define positionPop                  position_pop
+#define positionLegalMoves           position_legal_moves
+#define positionEnPassantMove        position_en_passant_move
+#define positionMakeMove             position_make_move
+#define positionUndoMove             position_undo_move
+#define positionIsAttacked           position_is_attacked
+#define positionIsInCheck            position_is_in_check
+#define positionGenerateValidMoves   position_generate_valid_moves
+#define positionGenerateCaptures     position_generate_captures
+#define positionGenerateQuiets       position_generate_quiets
+#define positionGenerateEvasions     position_generate_evasions
+#define positionCountValidMoves      position_count_valid_moves
+#define positionIsLegalMove          position_is_legal_move
+#define positionCheckInfo            position_check_info
+#define positionGivesCheck           position_gives_check
+#define positionPerft                position_perft
+#define positionPerftParallel        position_perft_parallel
+#define positionPerftHashed          position_perft_hashed
+#define positionPerftDivide          position_perft_divide
+#define positionPerftJournal         position_perft_journal
+#define positionPerftFrontier        position_perft_frontier
+#define positionPerftStats           position_perft_stats
+#define perftTableInit               perft_table_init
+#define perftTableClear              perft_table_clear
+#define perftTableFree               perft_table_free
+#define perftTableHitRate            perft_table_hit_rate
+#define perftTableOpen               perft_table_open
+#define positionHash                 position_hash
+#define positionEvaluate             position_evaluate
+#define positionSearch               position_search
+#define moveGeneratorInit            move_generator_init
+#define moveGeneratorNext            move_generator_next
+#define searchTableInit              search_table_init
+#define searchTableResize            search_table_resize
+#define searchTableClear             search_table_clear
+#define searchTableFree              search_table_free
+#define searchTableHashfull          search_table_hashfull
+
 #endif // USE_CAMEL_CASE
 
 CHESSDEF void print_board(char board[64]);
@@ -149,12 +448,21 @@ CHESSDEF bool is_in_check(const char board[64], const Player player); /* DONE BO
 CHESSDEF bool is_checkmate(char board[64], const Player player, const Move last_move); /* DONE BOTH */
 CHESSDEF bool is_stalemate(char board[64], const Player player, const Move last_move); /* DONE BOTH */
 
-// Add *add_move() as a function parameter
-static void add_move(char board[64], Move valid_moves[MAX_VALID_MOVES], const Move move, unsigned char* count, const Player player);
 CHESSDEF void generate_valid_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const unsigned char castle, const Move last_move); /* DONE BOTH */
+CHESSDEF void generate_capture_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move); /* DONE BOTH */
+CHESSDEF void generate_quiet_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle);  /* DONE BOTH */
+CHESSDEF void generate_evasion_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move); /* DONE BOTH */
+CHESSDEF unsigned int count_valid_moves(char board[64], const Player player, const Castle castle, const Move last_move); /* DONE BOTH */
 
 CHESSDEF bool is_attacked(const char board[64], const Square square, const Player player); /* DONE BOTH */
 CHESSDEF unsigned long long perft(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player); /* DONE BOTH */
+CHESSDEF unsigned long long perft_parallel(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, unsigned int split_ply, PerftThreadStats* stats); /* DONE BOTH */
+CHESSDEF unsigned long long perft_hashed(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftTable* table); /* DONE BOTH */
+CHESSDEF unsigned long long perft_divide(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, PerftDivideCallback callback, void* data); /* DONE BOTH */
+CHESSDEF bool perft_journal(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, const char* path, unsigned int threads, unsigned int split_ply, PerftProgressCallback progress, void* data, unsigned long long* nodes); /* DONE BOTH */
+CHESSDEF bool perft_frontier(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int frontier_ply, unsigned int threads, const size_t megabytes, PerftFrontierStats* stats, unsigned long long* nodes); /* DONE BOTH */
+CHESSDEF unsigned long long perft_stats(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftStats stats[]); /* DONE BOTH */
+CHESSDEF Move search_best_move(char board[64], const Player player, const Castle castle, const Move last_move, const SearchLimits* limits, SearchTable* table, SearchResult* result);
 
 // Not tested yet!
 CHESSDEF bool can_en_passant(const char board[64], const Player player, const Move last_move); /* DONE BOTH */
@@ -162,22 +470,83 @@ CHESSDEF bool has_castle_rights(const char board[64], const Player player, Castl
 CHESSDEF bool can_castle(const char board[64], const Player player, Castle* castle);           /* DONE BOTH */
 
 // In develop
-CHESSDEF bool is_check_move(const char board[64], Move move);
+CHESSDEF bool is_check_move(const char board[64], Move move); // `move` has to be legal, an illegal one may be answered either way
 CHESSDEF bool is_capture_move(const char board[64], const Move move);
 CHESSDEF bool is_attacked_by_piece(const char board[64], const Square square, char piece);
 CHESSDEF void filter_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char *count, bool (*filter)(char board[64], const Move move));
 CHESSDEF void move_to_PGN(Move move, char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char count, char *dest);
 CHESSDEF bool is_move_in_valid_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count, Move move);
 CHESSDEF bool is_legal_move(char board[64], const Move move, Castle castle, Move last_move);
+CHESSDEF void move_to_UCI(Move move, char dest[6]); // e2e4, e7e8q, castling as the king move e1g1
+
+CHESSDEF bool parse_fen(const char* fen, char board[64], Player* player, Castle* castle, Move* last_move); // false on a malformed FEN, en passant square as the double push that allows it
+CHESSDEF void fen_to_board(char board[64], char *fen); // Piece placement only, empty board when it is malformed
 
 // TODO:
-CHESSDEF void fen_to_board(char board[64], char *fen);
 CHESSDEF void board_to_fen(char *fen, char board[64]);
-// CHESSDEF void generate_valid_moves_action(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const unsigned char castle, const Move last_move, void (*action)(char board[64], Move valid_moves[MAX_VALID_MOVES], Move move, unsigned char* count, Player player));
 //CHESSDEF void sort_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char *count, int (*cmp)(Move a, Move b));
 
 CHESSDEF void sort_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count, int (*cmp[])(Move a, Move b), size_t cmp_count);
 
+// Bitboards
+CHESSDEF Bitboard board_piece_mask(const char board[64], const char piece);    // Bit `n` is set when board[n] == piece
+CHESSDEF Bitboard board_player_mask(const char board[64], const Player player); // BOTH gives every occupied square
+CHESSDEF void init_attack_tables(void); // Also seeds the Zobrist keys, called by position_init and is_attacked, safe to call more than once
+CHESSDEF void position_init(Position* position, const char board[64]); // White to move, castle rights the board allows
+CHESSDEF void position_set(Position* position, const char board[64], const Player player, const Castle castle, const Move last_move);
+CHESSDEF void position_set_history(Position* position, PositionUndo history[], const unsigned short size); // Undo stack for position_push, position_init/position_set detach it
+CHESSDEF void position_push(Position* position, const Move move);
+CHESSDEF Move position_pop(Position* position); // Returns the move that was undone, NO_MOVE on an empty stack
+CHESSDEF void position_legal_moves(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count); // For the side to move
+CHESSDEF Move position_en_passant_move(const Position* position); // `last_move` for the generators, the double push that allows en passant or NO_MOVE
+CHESSDEF void position_make_move(Position* position, const Move move);
+CHESSDEF void position_undo_move(Position* position, const Move move, const char captured_piece);
+CHESSDEF bool position_is_attacked(const Position* position, const Square square, const Player player);
+CHESSDEF bool position_is_in_check(const Position* position, const Player player);
+CHESSDEF void position_generate_valid_moves(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle, const Move last_move);
+CHESSDEF void position_generate_captures(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move);
+CHESSDEF void position_generate_quiets(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle);
+CHESSDEF void position_generate_evasions(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move); // Nothing when not in check
+CHESSDEF unsigned int position_count_valid_moves(const Position* position, const Player player, const Castle castle, const Move last_move); // Same count as position_generate_valid_moves, no move list
+CHESSDEF bool position_is_legal_move(const Position* position, const Move move, const Player player, const Castle castle, const Move last_move); // BOTH accepts a legal move of either player
+CHESSDEF void position_check_info(const Position* position, const Player player, CheckInfo* info);
+CHESSDEF bool position_gives_check(const Position* position, const CheckInfo* info, const Move move); // `move` has to be legal
+CHESSDEF unsigned long long position_perft(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player);
+CHESSDEF unsigned long long position_perft_hashed(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftTable* table);
+// `stats` needs `depth` entries, stats[i] counts the moves played at ply i + 1
+CHESSDEF unsigned long long position_perft_stats(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftStats stats[]);
+// `threads` 0 uses every online CPU, `split_ply` 0 uses PERFT_DEFAULT_SPLIT_PLY, `stats` (may be NULL) needs an entry per thread
+CHESSDEF unsigned long long position_perft_parallel(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, unsigned int split_ply, PerftThreadStats* stats);
+// Root moves are counted in parallel, `callback` (may be NULL) is called in the order they finish, never concurrently
+CHESSDEF unsigned long long position_perft_divide(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, PerftDivideCallback callback, void* data);
+// Resumable perft: finished work units are appended to the journal at `path`, a rerun of the same job skips them.
+// False when the journal can not be written or belongs to another job, `progress` (may be NULL) is never called concurrently
+CHESSDEF bool position_perft_journal(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, const char* path, unsigned int threads, unsigned int split_ply, PerftProgressCallback progress, void* data, unsigned long long* nodes);
+// Breadth-first perft that merges transpositions up to `frontier_ply` (0 uses PERFT_FRONTIER_DEFAULT_PLY) within `megabytes`,
+// larger plies are spilled to temporary files. False when the memory or a temporary file can not be had, `stats` may be NULL
+CHESSDEF bool position_perft_frontier(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int frontier_ply, unsigned int threads, const size_t megabytes, PerftFrontierStats* stats, unsigned long long* nodes);
+CHESSDEF Bitboard position_hash(const Position* position, const Player player, const Castle castle, const Move last_move); // 64-bit Zobrist key, `player` is the side to move
+CHESSDEF int position_evaluate(const Position* position); // Centipawns for the side to move
+// Iterative deepening alpha-beta for the side to move on a copy of `position`, repetitions of the game on its undo stack are seen.
+// Returns the best move, NO_MOVE without a legal one, `table` and `result` may be NULL.
+// With more than one thread every helper searches its own copy of `position` through the shared `table` (Lazy SMP)
+CHESSDEF Move position_search(Position* position, const SearchLimits* limits, SearchTable* table, SearchResult* result);
+
+CHESSDEF void move_generator_init(MoveGenerator* generator, Position* position, const Player player, const Castle castle, const Move last_move, const Move hash_move, const Move killers[2]); // killers may be NULL
+CHESSDEF Move move_generator_next(MoveGenerator* generator); // NO_MOVE once every legal move was returned
+
+CHESSDEF bool perft_table_init(PerftTable* table, const size_t megabytes); // false when the memory can not be allocated
+CHESSDEF void perft_table_clear(PerftTable* table);
+CHESSDEF void perft_table_free(PerftTable* table);
+CHESSDEF double perft_table_hit_rate(const PerftTable* table); // hits / probes since the last clear
+// File backed table, `megabytes` only sizes a new file. A file written by another version or move generator is replaced. False without mmap support
+CHESSDEF bool perft_table_open(PerftTable* table, const char* path, const size_t megabytes);
+
+CHESSDEF bool search_table_init(SearchTable* table, const size_t megabytes); // false when the memory can not be allocated
+CHESSDEF bool search_table_resize(SearchTable* table, const size_t megabytes); // Drops the entries, the old table stays when the new one can not be allocated
+CHESSDEF void search_table_clear(SearchTable* table); // Not while a search is using the table
+CHESSDEF void search_table_free(SearchTable* table);
+CHESSDEF int search_table_hashfull(const SearchTable* table); // Permille of a sample written by the current search
 
 #ifdef __cplusplus
 }
@@ -187,6 +556,364 @@ CHESSDEF void sort_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count,
 
 #ifdef CHESS_IMPLEMENTATION
 
+#include <stdlib.h>
+#include <time.h>
+
+// Parallel perft and thread-safe table initialization, CHESS_NO_THREADS makes perft_parallel run serially
+#if !defined(CHESS_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define CHESS_THREADS_AVAILABLE
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Persistent perft tables need POSIX.1-2008 (ftruncate, mmap), which a strict -std=c11 build without _POSIX_C_SOURCE
+// does not declare. Without it, or with CHESS_NO_MMAP, perft_table_open fails
+#if !defined(CHESS_NO_MMAP) && (defined(__APPLE__) || (defined(__unix__) && defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L))
+#define CHESS_MMAP_AVAILABLE
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(CHESS_NO_PEXT)
+#define CHESS_PEXT_AVAILABLE
+#include <immintrin.h>
+#endif
+
+// Board scanning kernels, picked by the target flags (-mavx2, SSE2 is the x86-64 baseline), CHESS_NO_SIMD forces the scalar loop
+#if !defined(CHESS_NO_SIMD) && defined(__AVX2__)
+#define CHESS_BOARD_AVX2
+#include <immintrin.h>
+#elif !defined(CHESS_NO_SIMD) && defined(__SSE2__)
+#define CHESS_BOARD_SSE2
+#include <emmintrin.h>
+#endif
+
+static const signed char BISHOP_DIRECTIONS[4][2] = {{-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+static const signed char ROOK_DIRECTIONS[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+/*
+ * Fancy magic bitboards: every square owns a slice of the shared attack table indexed by
+ * `((occupied & mask) * magic) >> shift`, or by `pext(occupied, mask)` when the CPU supports BMI2.
+ */
+typedef struct
+{
+	Bitboard mask;     // relevant occupancy, board edges are excluded
+	Bitboard magic;
+	Bitboard* attacks;
+	unsigned char shift;
+} Magic;
+
+static Magic BISHOP_MAGICS[64];
+static Magic ROOK_MAGICS[64];
+static Bitboard BISHOP_TABLE[0x1480];
+static Bitboard ROOK_TABLE[0x19000];
+
+static Bitboard KNIGHT_ATTACKS[64];
+static Bitboard KING_ATTACKS[64];
+static Bitboard PAWN_ATTACKS[2][64]; // [player][square]
+static Bitboard BETWEEN[64][64];     // squares strictly between two aligned squares, 0 otherwise
+static Bitboard LINE[64][64];        // whole row, column or diagonal through two aligned squares, 0 otherwise
+
+static Bitboard ZOBRIST_PIECES[2][6][64]; // [player][piece type][square]
+static Bitboard ZOBRIST_CASTLE[64];       // [castle], one key per combination of the six castle bits
+static Bitboard ZOBRIST_EN_PASSANT[8];    // [column], only hashed when the capture is possible
+static Bitboard ZOBRIST_BLACK_TO_MOVE;
+
+#ifdef CHESS_THREADS_AVAILABLE
+static pthread_once_t attack_tables_once = PTHREAD_ONCE_INIT;
+#else
+static bool attack_tables_initialized = false;
+#endif // CHESS_THREADS_AVAILABLE
+
+#ifdef CHESS_PEXT_AVAILABLE
+static bool use_pext = false;
+
+__attribute__((target("bmi2"))) static inline Bitboard pext(const Bitboard bb, const Bitboard mask)
+{
+	return _pext_u64(bb, mask);
+}
+#endif // CHESS_PEXT_AVAILABLE
+
+static inline unsigned int magic_index(const Magic* magic, const Bitboard occupied)
+{
+#ifdef CHESS_PEXT_AVAILABLE
+	if (use_pext) return (unsigned int)pext(occupied, magic->mask);
+#endif // CHESS_PEXT_AVAILABLE
+
+	return (unsigned int)(((occupied & magic->mask) * magic->magic) >> magic->shift);
+}
+
+static inline Bitboard bishop_attacks(const Square square, const Bitboard occupied)
+{
+	const Magic* magic = &BISHOP_MAGICS[square];
+	return magic->attacks[magic_index(magic, occupied)];
+}
+
+static inline Bitboard rook_attacks(const Square square, const Bitboard occupied)
+{
+	const Magic* magic = &ROOK_MAGICS[square];
+	return magic->attacks[magic_index(magic, occupied)];
+}
+
+static Bitboard knight_attacks_bb(const Bitboard bb)
+{
+	const Bitboard l1 = (bb >> 1) & ~FILE_H_BB;
+	const Bitboard l2 = (bb >> 2) & ~(FILE_G_BB | FILE_H_BB);
+	const Bitboard r1 = (bb << 1) & ~FILE_A_BB;
+	const Bitboard r2 = (bb << 2) & ~(FILE_A_BB | FILE_B_BB);
+	const Bitboard h1 = l1 | r1;
+	const Bitboard h2 = l2 | r2;
+	return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+}
+
+static Bitboard king_attacks_bb(const Bitboard bb)
+{
+	const Bitboard row = bb | ((bb >> 1) & ~FILE_H_BB) | ((bb << 1) & ~FILE_A_BB);
+	return (row | (row >> 8) | (row << 8)) & ~bb;
+}
+
+// Squares attacked by pawns of `player` standing on `bb` (white pawns move towards row 0)
+static Bitboard pawn_attacks_bb(const Bitboard bb, const Player player)
+{
+	return player == WHITE ?
+		((bb >> 9) & ~FILE_H_BB) | ((bb >> 7) & ~FILE_A_BB) :
+		((bb << 7) & ~FILE_H_BB) | ((bb << 9) & ~FILE_A_BB);
+}
+
+// Slow ray walking, only used to fill the magic tables
+static Bitboard ray_attacks(const Square square, const Bitboard occupied, const signed char directions[4][2])
+{
+	Bitboard attacks = 0;
+	for (unsigned char d = 0; d < 4; d++)
+	{
+		int row = GET_ROW(square) + directions[d][0];
+		int col = GET_COL(square) + directions[d][1];
+		while (row >= 0 && row < 8 && col >= 0 && col < 8)
+		{
+			const Bitboard target = SQUARE_BB(row * 8 + col);
+			attacks |= target;
+			if (occupied & target) break;
+			row += directions[d][0];
+			col += directions[d][1];
+		}
+	}
+	return attacks;
+}
+
+// Found once with a sparse random search for this square layout (0 -> a8), shift = 64 - bits in the mask
+static const Bitboard BISHOP_MAGIC_NUMBERS[64] = {
+	0x10102002004A1420ULL, 0x8020040400584008ULL, 0x10510800811201C8ULL, 0x5204042080000088ULL,
+	0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200A02020ULL,
+	0x1500241990010E00ULL, 0x8001200182020A40ULL, 0x40004101030B0000ULL, 0x8002041042000100ULL,
+	0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020A00ULL, 0x8000088400880520ULL,
+	0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+	0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+	0x0006E080100C3040ULL, 0x0501044A11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+	0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422C012400ULL, 0x0002128698404812ULL,
+	0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+	0xA010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802A02020000B098ULL,
+	0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488A00ULL,
+	0x2000081104004040ULL, 0x4C8E029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+	0x0000822802400008ULL, 0x00008A0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+	0x4A1500401041004AULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+	0x0040808800B62048ULL, 0x0000810400C44420ULL, 0x00080400440C0441ULL, 0x8340080020840411ULL,
+	0x0000000104208200ULL, 0x0000800810D00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL,
+};
+static const Bitboard ROOK_MAGIC_NUMBERS[64] = {
+	0x1080004008801020ULL, 0x0840092002C03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+	0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+	0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+	0x000A001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+	0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021D00100ULL,
+	0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000A0001768104ULL,
+	0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+	0x0442000A00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040A00128541ULL,
+	0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+	0x0400802402800800ULL, 0xC100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+	0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000A0020ULL,
+	0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+	0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040A00300ULL, 0x0801100280080480ULL,
+	0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+	0x0000209300488001ULL, 0x04C1002414824001ULL, 0x020020000B001041ULL, 0x7000100004200901ULL,
+	0x8002002004100802ULL, 0x30010002084C0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL,
+};
+
+static void init_magics(Magic magics[64], const Bitboard numbers[64], Bitboard* table, const signed char directions[4][2])
+{
+	Bitboard* attacks = table;
+
+	for (Square square = 0; square < 64; square++)
+	{
+		Magic* magic = &magics[square];
+		const Bitboard edges = ((ROW_BB(0) | ROW_BB(7)) & ~ROW_BB(GET_ROW(square))) |
+		                       ((FILE_A_BB | FILE_H_BB) & ~(FILE_A_BB << GET_COL(square)));
+
+		magic->mask = ray_attacks(square, 0, directions) & ~edges;
+		magic->magic = numbers[square];
+		magic->shift = 64 - POP_COUNT(magic->mask);
+		magic->attacks = attacks;
+
+		// Carry-Rippler trick to enumerate every subset of the mask
+		Bitboard occupied = 0;
+		do
+		{
+			magic->attacks[magic_index(magic, occupied)] = ray_attacks(square, occupied, directions);
+			attacks++;
+			occupied = (occupied - magic->mask) & magic->mask;
+		} while (occupied);
+	}
+}
+
+// xorshift64*, fixed seed so keys are identical between runs and builds
+static inline Bitboard zobrist_random(Bitboard* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void init_zobrist(void)
+{
+	Bitboard state = 0x9E3779B97F4A7C15ULL;
+
+	for (unsigned char player = BLACK; player <= WHITE; player++)
+		for (unsigned char type = PIECE_PAWN; type <= PIECE_KING; type++)
+			for (Square square = 0; square < 64; square++)
+				ZOBRIST_PIECES[player][type][square] = zobrist_random(&state);
+
+	// Combinations are XORs of one key per bit, so dropping a right is a single XOR as well
+	Bitboard castle_bits[6];
+	for (unsigned char bit = 0; bit < 6; bit++) castle_bits[bit] = zobrist_random(&state);
+	for (unsigned char castle = 0; castle < 64; castle++)
+	{
+		ZOBRIST_CASTLE[castle] = 0;
+		for (unsigned char bit = 0; bit < 6; bit++)
+			if (castle & (1 << bit)) ZOBRIST_CASTLE[castle] ^= castle_bits[bit];
+	}
+
+	for (unsigned char col = 0; col < 8; col++) ZOBRIST_EN_PASSANT[col] = zobrist_random(&state);
+	ZOBRIST_BLACK_TO_MOVE = zobrist_random(&state);
+}
+
+static void init_attack_tables_once(void)
+{
+	init_zobrist();
+
+	for (Square square = 0; square < 64; square++)
+	{
+		KNIGHT_ATTACKS[square] = knight_attacks_bb(SQUARE_BB(square));
+		KING_ATTACKS[square] = king_attacks_bb(SQUARE_BB(square));
+		PAWN_ATTACKS[WHITE][square] = pawn_attacks_bb(SQUARE_BB(square), WHITE);
+		PAWN_ATTACKS[BLACK][square] = pawn_attacks_bb(SQUARE_BB(square), BLACK);
+	}
+
+#ifdef CHESS_PEXT_AVAILABLE
+	use_pext = __builtin_cpu_supports("bmi2");
+#endif // CHESS_PEXT_AVAILABLE
+
+	init_magics(BISHOP_MAGICS, BISHOP_MAGIC_NUMBERS, BISHOP_TABLE, BISHOP_DIRECTIONS);
+	init_magics(ROOK_MAGICS, ROOK_MAGIC_NUMBERS, ROOK_TABLE, ROOK_DIRECTIONS);
+
+	for (Square a = 0; a < 64; a++)
+	{
+		for (Square b = 0; b < 64; b++)
+		{
+			BETWEEN[a][b] = LINE[a][b] = 0;
+			if (a == b) continue;
+
+			if (rook_attacks(a, 0) & SQUARE_BB(b))
+			{
+				BETWEEN[a][b] = rook_attacks(a, SQUARE_BB(b)) & rook_attacks(b, SQUARE_BB(a));
+				LINE[a][b] = (rook_attacks(a, 0) & rook_attacks(b, 0)) | SQUARE_BB(a) | SQUARE_BB(b);
+			}
+			else if (bishop_attacks(a, 0) & SQUARE_BB(b))
+			{
+				BETWEEN[a][b] = bishop_attacks(a, SQUARE_BB(b)) & bishop_attacks(b, SQUARE_BB(a));
+				LINE[a][b] = (bishop_attacks(a, 0) & bishop_attacks(b, 0)) | SQUARE_BB(a) | SQUARE_BB(b);
+			}
+		}
+	}
+}
+
+CHESSDEF void init_attack_tables(void)
+{
+#ifdef CHESS_THREADS_AVAILABLE
+	pthread_once(&attack_tables_once, init_attack_tables_once);
+#else
+	if (attack_tables_initialized) return;
+	init_attack_tables_once();
+	attack_tables_initialized = true;
+#endif // CHESS_THREADS_AVAILABLE
+}
+
+// Squares whose character lies in [first, last], one vector compare per 32 (AVX2) or 16 (SSE2) squares
+static inline Bitboard board_range_mask(const char board[64], const char first, const char last)
+{
+	Bitboard mask = 0;
+
+#if defined(CHESS_BOARD_AVX2)
+	const __m256i lowest = _mm256_set1_epi8(first);
+	const __m256i span = _mm256_set1_epi8((char)(last - first));
+	for (unsigned char i = 0; i < 2; i++)
+	{
+		// Unsigned `board[n] - first <= last - first`, SSE/AVX only have signed byte compares
+		const __m256i offset = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(board + i * 32)), lowest);
+		const __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, span), offset);
+		mask |= (Bitboard)(unsigned int)_mm256_movemask_epi8(in_range) << (i * 32);
+	}
+#elif defined(CHESS_BOARD_SSE2)
+	const __m128i lowest = _mm_set1_epi8(first);
+	const __m128i span = _mm_set1_epi8((char)(last - first));
+	for (unsigned char i = 0; i < 4; i++)
+	{
+		const __m128i offset = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(board + i * 16)), lowest);
+		const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+		mask |= (Bitboard)(unsigned int)_mm_movemask_epi8(in_range) << (i * 16);
+	}
+#else
+	// SWAR, 8 squares per step: board characters are 7-bit ASCII, so adding (0x80 - c) sets bit 7 exactly for bytes >= c
+	const unsigned long long ones = 0x0101010101010101ULL;
+	for (unsigned char row = 0; row < 8; row++)
+	{
+		unsigned long long chunk;
+		memcpy(&chunk, board + row * 8, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		chunk = __builtin_bswap64(chunk);
+#endif
+		const unsigned long long in_range = (chunk + ones * (0x80 - first)) & ~(chunk + ones * (0x7F - last)) & (ones << 7);
+
+		// Bit 7 of byte `n` goes to bit `n`
+		mask |= (((in_range >> 7) * 0x0102040810204080ULL) >> 56) << (row * 8);
+	}
+#endif
+
+	return mask;
+}
+
+CHESSDEF Bitboard board_piece_mask(const char board[64], const char piece)
+{
+	return board_range_mask(board, piece, piece);
+}
+
+CHESSDEF Bitboard board_player_mask(const char board[64], const Player player)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	switch (player)
+	{
+	case WHITE: return board_range_mask(board, 'A', 'Z');
+	case BLACK: return board_range_mask(board, 'a', 'z');
+	case BOTH:  return ~board_piece_mask(board, ' ');
+	default:    UNREACHABLE; return 0;
+	}
+}
+
 CHESSDEF void print_board(char board[64])
 {
 	printf("  a b c d e f g h\n");
@@ -363,70 +1090,21 @@ CHESSDEF bool is_attacked(const char board[64], const Square square, const Playe
 		return false;
 	}
 
-	if ((IS_VALID_SQUARE(square + (player == BLACK ? -7 : 7)) &&
-			ABS(GET_COL(square) - GET_COL(square + (player == BLACK ? -7 : 7))) == 1 &&
-			board[square + (player == BLACK ? -7 : 7)] == (player == WHITE ? 'P' : 'p')) ||
-		(IS_VALID_SQUARE(square + (player == BLACK ? -9 : 9)) &&
-			ABS(GET_COL(square) - GET_COL(square + (player == BLACK ? -9 : 9))) == 1 &&
-			board[square + (player == BLACK ? -9 : 9)] == (player == WHITE ? 'P' : 'p')))
-	{
-		return true;
-	}
+	init_attack_tables();
 
-	const char knight_moves[8] = {-17, -15, -10, -6, 6, 10, 15, 17};
-	for (unsigned char i = 0; i < 8; i++)
+	// Piece masks are only built for the attacker types that get tested
+	if ((PAWN_ATTACKS[SWITCH_PLAYER(player)][square] & board_piece_mask(board, PIECE_CHAR(player, PIECE_PAWN))) ||
+	    (KNIGHT_ATTACKS[square] & board_piece_mask(board, PIECE_CHAR(player, PIECE_KNIGHT))) ||
+	    (KING_ATTACKS[square] & board_piece_mask(board, PIECE_CHAR(player, PIECE_KING))))
 	{
-		const Square target_square = square + knight_moves[i];
-		if (IS_VALID_SQUARE(target_square) &&
-			ABS(GET_COL(target_square) - GET_COL(square)) <= 2 &&
-			ABS(GET_ROW(target_square) - GET_ROW(square)) <= 2 &&
-			board[target_square] == (player == WHITE ? 'N' : 'n'))
-		{
-			return true;
-		}
+		return true;
 	}
 
+	const Bitboard occupied = board_player_mask(board, BOTH);
+	const Bitboard queens = board_piece_mask(board, PIECE_CHAR(player, PIECE_QUEEN));
 
-	const char directions[8] = {1, -1, 8, -8, 9, 7, -9, -7};
-	for (unsigned char d = 0; d < 8; ++d)
-	{
-		for (unsigned char k = 1; k < 8; ++k)
-		{
-			const char direction = directions[d];
-			const Square target_square = square + direction * k;
-
-			if (!IS_VALID_SQUARE(target_square)) break;
-
-			const unsigned char row = GET_ROW(target_square);
-			const unsigned char col = GET_COL(target_square);
-
-			if ((direction == 1 && col == 0) ||
-				(direction == -1 && col == 7) ||
-				// (directions[d] == 8 && row == 0) ||
-				// (directions[d] == -8 && row == 7) ||
-				(direction == 9 && (col == 0 || row == 0)) ||
-				(direction == -9 && (col == 7 || row == 7)) ||
-				(direction == 7 && (col == 7 || row == 0)) ||
-				(direction == -7 && (col == 0 || row == 7)))
-			{
-				break;
-			}
-
-			const char piece = board[target_square];
-			if (piece != ' ')
-			{
-				if (piece == ((player == WHITE) ? 'Q' : 'q') ||
-					(d <= 3 && piece == (player == WHITE ? 'R' : 'r')) ||
-					(d > 3 && piece == (player == WHITE ? 'B' : 'b')) ||
-					(piece == (player == WHITE ? 'K' : 'k') && k == 1))
-				{
-					return true;
-				}
-				break;
-			}
-		}
-	}
-	return false;
+	return (bishop_attacks(square, occupied) & (board_piece_mask(board, PIECE_CHAR(player, PIECE_BISHOP)) | queens)) ||
+	       (rook_attacks(square, occupied) & (board_piece_mask(board, PIECE_CHAR(player, PIECE_ROOK)) | queens));
 }
 
 CHESSDEF bool is_in_check(const char board[64], const Player player)
@@ -441,13 +1119,10 @@ CHESSDEF bool is_in_check(const char board[64], const Player player)
         return is_in_check(board, WHITE) || is_in_check(board, BLACK);
 	}
 
-	const char king = player == WHITE ? 'K' : 'k';
+	const Bitboard king = board_piece_mask(board, PIECE_CHAR(player, PIECE_KING));
+	if (!king) return false;
 
-	for (Square square = 0; square < 64; square++)
-	{
-		if (board[square] == king) return is_attacked(board, square, SWITCH_PLAYER(player));
-	}
-	return false;
+	return is_attacked(board, LSB(king), SWITCH_PLAYER(player));
 }
 
 CHESSDEF bool is_checkmate(char board[64], const Player player, const Move last_move)
@@ -463,16 +1138,18 @@ CHESSDEF bool is_checkmate(char board[64], const Player player, const Move last_
 
 	if (is_in_check(board, player))
 	{
-		Move valid_moves[MAX_VALID_MOVES];
-		unsigned char count;
+		Position position;
+		MoveGenerator generator;
+		position_init(&position, board);
 
 		// Needs to use last move for en-passant (case where en-passant will save you from checkmate)
 		// https://chess.stackexchange.com/questions/22006/en-passant-checkmate#:~:text=The%20answer%20in%20both%20cases%20is%20no%2C%20since,probably%20win%20the%20game%20via%20the%20clock%20%3A%29
 		// Castle is not necessary because if the player is in check he can't castle
 
-		generate_valid_moves(board, valid_moves, &count, player, 0, last_move);
+		// Stops at the first legal move instead of generating all of them
+		move_generator_init(&generator, &position, player, 0, last_move, NO_MOVE, NULL);
 
-		if (count == 0) return true;
+		if (move_generator_next(&generator) == NO_MOVE) return true;
 	}
 	return false;
 }
@@ -489,16 +1166,18 @@ CHESSDEF bool is_stalemate(char board[64], const Player player, const Move last_
 
 	if (!is_in_check(board, player))
 	{
-		Move valid_moves[MAX_VALID_MOVES];
-		unsigned char count;
+		Position position;
+		MoveGenerator generator;
+		position_init(&position, board);
 
 		// Needs to use last move for en-passant (case where en-passant is the only left move)
 		// Castle is not needed because if the player's only move is castle, then he could move the rook also, so it won't be a stalemate
 		// => Castle can't be only left move at any given position (hope so)
 
-		generate_valid_moves(board, valid_moves, &count, player, 0, last_move);
+		// Stops at the first legal move instead of generating all of them
+		move_generator_init(&generator, &position, player, 0, last_move, NO_MOVE, NULL);
 
-		if (count == 0) return true;
+		if (move_generator_next(&generator) == NO_MOVE) return true;
 	}
 	return false;
 }
@@ -515,20 +1194,17 @@ CHESSDEF bool can_en_passant(const char board[64], const Player player, const Mo
 		return can_en_passant(board, WHITE, last_move) || can_en_passant(board, BLACK, last_move);
 	}
 
-	for (Square square = 24; square < 40; square++)
+	if (ABS(GET_FROM(last_move) - GET_TO(last_move)) != 16 || board[GET_TO(last_move)] != (player == WHITE ? 'p' : 'P'))
 	{
-		if ((player == WHITE && board[square] == 'P') || (player == BLACK && board[square] == 'p'))
-		{
-			if (ABS(GET_FROM(last_move) - GET_TO(last_move)) == 16 && board[GET_TO(last_move)] == (player == WHITE ? 'p' : 'P'))
-			{
-				if (GET_ROW(square) == (player == WHITE ? 3 : 4) && ABS(GET_COL(square) - GET_COL(GET_TO(last_move))) == 1)
-				{
-					return true;
-				}
-			}
-		}
+		return false;
 	}
-	return false;
+
+	// Only the two squares next to the pushed pawn's column can hold a capturing pawn
+	const unsigned char row = player == WHITE ? 3 : 4;
+	const unsigned char col = GET_COL(GET_TO(last_move));
+	const char pawn = player == WHITE ? 'P' : 'p';
+
+	return (col > 0 && board[row * 8 + col - 1] == pawn) || (col < 7 && board[row * 8 + col + 1] == pawn);
 }
 
 
@@ -636,396 +1312,99 @@ bool can_castle(const char *board, const Player player, Castle *castle) {
 }
 
 
-static void add_move(char board[64], Move valid_moves[MAX_VALID_MOVES], const Move move, unsigned char* count, const Player player)
+CHESSDEF void generate_valid_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const unsigned char castle, const Move last_move)
 {
-#ifdef USE_PLAYER_CHECK
-    if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
-#endif // USE_PLAYER_CHECK
+	Position position;
+	position_init(&position, board);
+	position_generate_valid_moves(&position, valid_moves, count, player, castle, last_move);
+}
 
-    const char captured_piece = board[GET_TO(move)];
-	make_move(board, move);
+CHESSDEF void generate_capture_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move)
+{
+	Position position;
+	position_init(&position, board);
+	position_generate_captures(&position, valid_moves, count, player, last_move);
+}
 
-	if (!is_in_check(board, player))
-	{
-		valid_moves[(*count)++] = move;
-	}
+CHESSDEF void generate_quiet_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle)
+{
+	Position position;
+	position_init(&position, board);
+	position_generate_quiets(&position, valid_moves, count, player, castle);
+}
 
-	undo_move(board, move, captured_piece);
+CHESSDEF void generate_evasion_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move)
+{
+	Position position;
+	position_init(&position, board);
+	position_generate_evasions(&position, valid_moves, count, player, last_move);
 }
 
-CHESSDEF void generate_valid_moves_action(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, Castle castle, const Move last_move, void (*action)(char board[64], Move valid_moves[MAX_VALID_MOVES], Move move, unsigned char* count, Player player))
+CHESSDEF unsigned int count_valid_moves(char board[64], const Player player, const Castle castle, const Move last_move)
 {
-	// TODO: do the action on adding move
+	Position position;
+	position_init(&position, board);
+	return position_count_valid_moves(&position, player, castle, last_move);
 }
 
+CHESSDEF unsigned long long perft(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player)
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft(&position, depth, player, castle, last_move, switch_player);
+}
 
-CHESSDEF void generate_valid_moves(char board[64], Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const unsigned char castle, const Move last_move)
+CHESSDEF unsigned long long perft_hashed(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftTable* table)
 {
-	*count = 0;
+	Position position;
+	position_init(&position, board);
+	return position_perft_hashed(&position, depth, player, castle, last_move, switch_player, table);
+}
 
-	if (player == BOTH)
-	{
-		unsigned char white_count = 0, black_count = 0;
+CHESSDEF unsigned long long perft_parallel(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, unsigned int split_ply, PerftThreadStats* stats)
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft_parallel(&position, depth, player, castle, last_move, switch_player, threads, split_ply, stats);
+}
 
-		generate_valid_moves(board, valid_moves, &white_count, WHITE, castle, last_move);
-		generate_valid_moves(board, valid_moves + white_count, &black_count, BLACK, castle, last_move);
+CHESSDEF bool perft_journal(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, const char* path, unsigned int threads, unsigned int split_ply, PerftProgressCallback progress, void* data, unsigned long long* nodes)
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft_journal(&position, depth, player, castle, last_move, switch_player, path, threads, split_ply, progress, data, nodes);
+}
 
-		*count = white_count + black_count;
-		return;
-	}
+CHESSDEF bool perft_frontier(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int frontier_ply, unsigned int threads, const size_t megabytes, PerftFrontierStats* stats, unsigned long long* nodes)
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft_frontier(&position, depth, player, castle, last_move, switch_player, frontier_ply, threads, megabytes, stats, nodes);
+}
 
+CHESSDEF unsigned long long perft_stats(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftStats stats[])
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft_stats(&position, depth, player, castle, last_move, switch_player, stats);
+}
 
-	for (Square square = 0; square < 64; ++square)
-	{
-		const char piece = board[square];
+CHESSDEF unsigned long long perft_divide(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, PerftDivideCallback callback, void* data)
+{
+	Position position;
+	position_init(&position, board);
+	return position_perft_divide(&position, depth, player, castle, last_move, switch_player, threads, callback, data);
+}
 
-		if ((player == WHITE && IS_WHITE_PIECE(piece)) || (player == BLACK && IS_BLACK_PIECE(piece)))
-		{
-			switch (piece)
-			{
-			case 'p':
-			case 'P':
-				{
-					const char direction = piece == 'P' ? -8 : 8;
-					const Square target_square = square + direction;
-
-					// Move forward
-					if (IS_VALID_SQUARE(target_square) && board[target_square] == ' ')
-					{
-						if ((piece == 'P' && GET_ROW(target_square) == 0) || (piece == 'p' && GET_ROW(target_square) ==
-							7))
-						{
-							for (unsigned char promotion_piece = 0; promotion_piece < 4; ++promotion_piece)
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, PROMOTION, promotion_piece), count, player);
-							}
-						}
-						else
-						{
-							add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count, player);
-						}
-
-						// Double move from starting position
-						if ((piece == 'P' && GET_ROW(square) == 6) || (piece == 'p' && GET_ROW(square) == 1))
-						{
-							const Square double_target = square + 2 * direction;
-							if (board[double_target] == ' ')
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, double_target, NORMAL, 0), count,
-								         player);
-							}
-						}
-					}
-
-					// Captures
-					for (unsigned char i = 0; i < 2; i++)
-					{
-						const Square capture_square = square + (i == 0 ? direction - 1 : direction + 1);
-
-						if (IS_VALID_SQUARE(capture_square) &&
-							ABS(GET_COL(capture_square) - GET_COL(square)) == 1 &&
-							((player == WHITE && IS_BLACK_PIECE(board[capture_square])) ||
-								(player == BLACK && IS_WHITE_PIECE(board[capture_square]))))
-						{
-							if ((piece == 'P' && GET_ROW(capture_square) == 0) || (piece == 'p' && GET_ROW(
-								capture_square) == 7))
-							{
-								for (unsigned char promotion_piece = 0; promotion_piece < 4; ++promotion_piece)
-								{
-									add_move(board, valid_moves, CREATE_MOVE(square, capture_square, PROMOTION, promotion_piece), count, player);
-								}
-
-							}
-							else
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, capture_square, NORMAL, 0), count,
-								         player);
-							}
-						}
-					}
-
-					// En passant
-					if (last_move != NO_MOVE)
-					{
-						if (ABS(GET_FROM(last_move) - GET_TO(last_move)) == 16 && board[GET_TO(last_move)] == (
-							player == WHITE ? 'p' : 'P'))
-						{
-							if (GET_ROW(square) == (player == WHITE ? 3 : 4) && ABS(
-								GET_COL(square) - GET_COL(GET_TO(last_move))) == 1)
-							{
-								add_move(board, valid_moves,
-								         CREATE_MOVE(square, GET_TO(last_move) + direction, EN_PASSANT, 0), count,
-								         player);
-							}
-						}
-                    }
-				}
-				break;
+CHESSDEF Move search_best_move(char board[64], const Player player, const Castle castle, const Move last_move, const SearchLimits* limits, SearchTable* table, SearchResult* result)
+{
+	Position position;
+	position_set(&position, board, player, castle, last_move);
+	return position_search(&position, limits, table, result);
+}
 
-			case 'n':
-			case 'N':
-				{
-					const char knight_moves[8] = {-17, -15, -10, -6, 6, 10, 15, 17};
-					for (unsigned char i = 0; i < 8; i++)
-					{
-						const Square target_square = square + knight_moves[i];
-						if (IS_VALID_SQUARE(target_square) &&
-							ABS(GET_COL(target_square) - GET_COL(square)) <= 2 &&
-							ABS(GET_ROW(target_square) - GET_ROW(square)) <= 2 &&
-							(board[target_square] == ' ' || (IS_BLACK_PIECE(board[target_square]) && player == WHITE) ||
-								(IS_WHITE_PIECE(board[target_square]) && player == BLACK)))
-						{
-							add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count, player);
-						}
-					}
-				}
-				break;
-
-			case 'b':
-			case 'B':
-				{
-					const char bishop_moves[4] = {-9, -7, 7, 9};
-					for (unsigned char i = 0; i < 4; i++)
-					{
-						for (unsigned char step = 1; step < 8; step++)
-						{
-							const Square target_square = square + bishop_moves[i] * step;
-							if (!IS_VALID_SQUARE(target_square)) break;
-
-							// Ensure new_pos is on the same diagonal
-							if (ABS(GET_COL(target_square) - GET_COL(square)) != ABS(
-								GET_ROW(target_square) - GET_ROW(square)))
-								break;
-
-							if (board[target_square] == ' ')
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-							}
-							else if ((player == WHITE && IS_BLACK_PIECE(board[target_square])) || (player == BLACK && IS_WHITE_PIECE(
-								board[target_square])))
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-								break;
-							}
-							else
-							{
-								break;
-							}
-						}
-					}
-				}
-				break;
-
-			case 'r':
-			case 'R':
-				{
-					const char rook_moves[4] = {-8, 8, -1, 1}; // Up, Down, Left, Right
-
-					for (unsigned char i = 0; i < 4; i++)
-					{
-						for (unsigned char step = 1; step < 8; step++)
-						{
-							const Square target_square = square + rook_moves[i] * step;
-
-							// Ensure target_square is valid
-							if (!IS_VALID_SQUARE(target_square)) break;
-
-							if ((i > 1) && GET_ROW(target_square) != GET_ROW(square)) break;
-
-							if (board[target_square] == ' ')
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-							}
-							else if ((player == WHITE && IS_BLACK_PIECE(board[target_square])) ||
-								(player == BLACK && IS_WHITE_PIECE(board[target_square])))
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-								break;
-							}
-							else
-							{
-								break;
-							}
-						}
-					}
-				}
-				break;
-
-			case 'q':
-			case 'Q':
-				{
-					const char queen_moves[8] = {-8, 8, -1, 1, -9, -7, 7, 9};
-
-					for (unsigned char i = 0; i < 8; i++)
-					{
-						for (unsigned char step = 1; step < 8; step++)
-						{
-							const Square target_square = square + queen_moves[i] * step;
-
-							if (!IS_VALID_SQUARE(target_square)) break;
-
-							if ((queen_moves[i] == -1 || queen_moves[i] == 1) && GET_ROW(target_square) != GET_ROW(
-								square))
-								break;
-
-							if ((queen_moves[i] == -9 || queen_moves[i] == -7 || queen_moves[i] == 7 || queen_moves[i]
-									== 9) &&
-								ABS(GET_COL(target_square) - GET_COL(square)) != ABS(
-									GET_ROW(target_square) - GET_ROW(square)))
-								break;
-
-							if (board[target_square] == ' ')
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-							}
-							else if ((player == WHITE && IS_BLACK_PIECE(board[target_square])) ||
-								(player == BLACK && IS_WHITE_PIECE(board[target_square])))
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-								break;
-							}
-							else
-							{
-								break;
-							}
-						}
-					}
-				}
-				break;
-
-			case 'k':
-			case 'K':
-				{
-					const char king_moves[8] = {-1, 1, -8, 8, -9, -7, 7, 9};
-					for (unsigned char i = 0; i < 8; i++)
-					{
-						const Square target_square = square + king_moves[i];
-						if (IS_VALID_SQUARE(target_square) && ABS(GET_COL(target_square) - GET_COL(square)) <= 1)
-						{
-							if (board[target_square] == ' ' ||
-								(IS_BLACK_PIECE(board[target_square]) && player == WHITE) ||
-								(IS_WHITE_PIECE(board[target_square]) && player == BLACK))
-							{
-								add_move(board, valid_moves, CREATE_MOVE(square, target_square, NORMAL, 0), count,
-								         player);
-							}
-						}
-					}
-				}
-				break;
-
-			default:
-                UNREACHABLE;
-			}
-		}
-	}
-
-	// Castling moves
-	if (player == WHITE)
-	{
-		if (!is_in_check(board, player))
-		{
-			if (board[61] == ' ' && board[62] == ' ' && !is_attacked(board, 61, SWITCH_PLAYER(player)) && !
-				is_attacked(board, 62, SWITCH_PLAYER(player)) && GET_CASTLE_WK(castle) && GET_CASTLE_WR2(castle))
-			{
-				add_move(board, valid_moves, CREATE_MOVE(60, 62, CASTLE, 0), count, player);
-			}
-
-			if (board[57] == ' ' && board[58] == ' ' && board[59] == ' ' && !is_attacked(
-					board, 58, SWITCH_PLAYER(player)) && !
-				is_attacked(board, 59, SWITCH_PLAYER(player)) && GET_CASTLE_WK(castle) && GET_CASTLE_WR1(castle))
-			{
-				add_move(board, valid_moves, CREATE_MOVE(60, 58, CASTLE, 0), count, player);
-			}
-		}
-	}
-    else if (player == BLACK)
-	{
-		if (!is_in_check(board, player))
-		{
-			if (board[5] == ' ' && board[6] == ' ' && !is_attacked(board, 5, SWITCH_PLAYER(player)) && !
-				is_attacked(board, 6, SWITCH_PLAYER(player)) && GET_CASTLE_BK(castle) && GET_CASTLE_BR2(castle))
-			{
-				add_move(board, valid_moves, CREATE_MOVE(4, 6, CASTLE, 0), count, player);
-			}
-
-			if (board[3] == ' ' && board[2] == ' ' && board[1] == ' ' && !is_attacked(board, 3, SWITCH_PLAYER(player))
-				&& !
-				is_attacked(board, 2, SWITCH_PLAYER(player)) && GET_CASTLE_BK(castle) && GET_CASTLE_BR1(castle))
-			{
-				add_move(board, valid_moves, CREATE_MOVE(4, 2, CASTLE, 0), count, player);
-			}
-		}
-	}
-    else
-    {
-        UNREACHABLE;
-    }
-}
-
-CHESSDEF unsigned long long perft(char board[64], const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player)
-{
-#ifdef USE_PLAYER_CHECK
-    if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
-#endif // USE_PLAYER_CHECK
-
-
-	if (depth == 0) return 1;
-
-	if (player == BOTH)
-	{
-		return perft(board, depth, WHITE, castle, last_move, switch_player) +
-			   perft(board, depth, BLACK, castle, last_move, switch_player);
-	}
-
-	Move valid_moves[MAX_VALID_MOVES];
-	unsigned char move_count = 0;
-	unsigned long long total_moves = 0;
-
-	Castle new_castle = castle;
-
-	update_castle(board, &new_castle);
-	generate_valid_moves(board, valid_moves, &move_count, player, new_castle, last_move);
-
-	for (int i = 0; i < move_count; i++)
-	{
-
-		/*
-
-		Old code with copying board.
-
-		char new_board[64] = {0};
-		COPY_BOARD(new_board, board);
-
-		make_move(new_board, valid_moves[i]);
-
-		const unsigned long long level_total = perft(new_board, depth - 1, switch_player ? SWITCH_PLAYER(player) : player, new_castle, valid_moves[i], switch_player);
-
-		total_moves += level_total;
-
-		*/
-
-		char capture_piece = board[GET_TO(valid_moves[i])];
-		make_move(board, valid_moves[i]);
-
-		const unsigned long long level_total = perft(board, depth - 1, switch_player ? SWITCH_PLAYER(player) : player, new_castle, valid_moves[i], switch_player);
-
-		undo_move(board, valid_moves[i], capture_piece);
-
-		total_moves += level_total;
-	}
-
-	return total_moves;
-}
-
-CHESSDEF bool is_attacked_by_piece(const char board[64], const Square square, char piece)
-{
+CHESSDEF bool is_attacked_by_piece(const char board[64], const Square square, char piece)
+{
 
 #ifdef USE_PLAYER_CHECK
     if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
@@ -1162,11 +1541,13 @@ CHESSDEF bool is_attacked_by_piece(const char board[64], const Square square, ch
 
 CHESSDEF bool is_check_move(const char board[64], Move move)
 {
-	char temp_board[64];
-	COPY_BOARD(temp_board, board);
-	make_move(temp_board, move);
+	if (board[GET_FROM(move)] == ' ') return false;
 
-	return is_in_check(temp_board, BOTH);
+	Position position;
+	CheckInfo info;
+	position_init(&position, board);
+	position_check_info(&position, PIECE_PLAYER(board[GET_FROM(move)]), &info);
+	return position_gives_check(&position, &info, move);
 }
 
 CHESSDEF bool is_capture_move(const char board[64], const Move move)
@@ -1269,6 +1650,101 @@ CHESSDEF void move_to_PGN(Move move, char board[64], Move valid_moves[MAX_VALID_
     notation[notation_length] = '\0';
 }
 
+CHESSDEF void move_to_UCI(Move move, char dest[6])
+{
+	unsigned char length = 0;
+
+	dest[length++] = (char)('a' + GET_COL(GET_FROM(move)));
+	dest[length++] = (char)('8' - GET_ROW(GET_FROM(move)));
+	dest[length++] = (char)('a' + GET_COL(GET_TO(move)));
+	dest[length++] = (char)('8' - GET_ROW(GET_TO(move)));
+
+	if (GET_TYPE(move) == PROMOTION) dest[length++] = "nbrq"[GET_PROM(move)];
+	dest[length] = '\0';
+}
+
+// Piece placement field, returns the rest of the FEN or NULL when the placement is malformed
+static const char* parse_fen_board(const char* fen, char board[64])
+{
+	memset(board, ' ', 64);
+
+	for (unsigned char row = 0; row < 8; row++)
+	{
+		unsigned char col = 0;
+		for (; *fen && *fen != '/' && *fen != ' '; fen++)
+		{
+			if (*fen >= '1' && *fen <= '8') col += *fen - '0';
+			else if (strchr("PNBRQKpnbrqk", *fen) != NULL && col < 8) board[row * 8 + col++] = *fen;
+			else return NULL;
+
+			if (col > 8) return NULL;
+		}
+
+		if (col != 8) return NULL;
+		if (row < 7 && *fen++ != '/') return NULL;
+	}
+
+	return fen;
+}
+
+CHESSDEF bool parse_fen(const char* fen, char board[64], Player* player, Castle* castle, Move* last_move)
+{
+	char placement[64];
+
+	fen = parse_fen_board(fen, placement);
+	if (fen == NULL) return false;
+
+	Player side = WHITE;
+	Castle rights = 0;
+	Move en_passant = NO_MOVE;
+
+	// Side to move, castle rights and en passant may be left out, halfmove and fullmove counters are ignored
+	while (*fen == ' ') fen++;
+	if (*fen)
+	{
+		if (*fen != 'w' && *fen != 'b') return false;
+		side = *fen++ == 'w' ? WHITE : BLACK;
+	}
+
+	while (*fen == ' ') fen++;
+	if (*fen == '-') fen++;
+	else for (; *fen && *fen != ' '; fen++)
+	{
+		switch (*fen)
+		{
+		case 'K': rights |= 0x01 | 0x04; break; // WK, WR2
+		case 'Q': rights |= 0x01 | 0x02; break; // WK, WR1
+		case 'k': rights |= 0x08 | 0x20; break; // BK, BR2
+		case 'q': rights |= 0x08 | 0x10; break; // BK, BR1
+		default: return false;
+		}
+	}
+
+	while (*fen == ' ') fen++;
+	if (*fen == '-') fen++;
+	else if (*fen)
+	{
+		if (fen[0] < 'a' || fen[0] > 'h' || (fen[1] != '3' && fen[1] != '6')) return false;
+
+		const Square square = (Square)((8 - (fen[1] - '0')) * 8 + (fen[0] - 'a'));
+		en_passant = fen[1] == '3'
+			? CREATE_MOVE(square + 8, square - 8, NORMAL, 0)  // white pushed
+			: CREATE_MOVE(square - 8, square + 8, NORMAL, 0); // black pushed
+		fen += 2;
+	}
+
+	memcpy(board, placement, 64);
+	if (player != NULL) *player = side;
+	if (castle != NULL) *castle = rights;
+	if (last_move != NULL) *last_move = en_passant;
+	return true;
+}
+
+CHESSDEF void fen_to_board(char board[64], char *fen)
+{
+	if (parse_fen_board(fen, board) == NULL) memset(board, ' ', 64);
+}
+
 CHESSDEF bool is_move_in_valid_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count, Move move)
 {
 	for (int i = 0; i < count; i++)
@@ -1280,10 +1756,9 @@ CHESSDEF bool is_move_in_valid_moves(Move valid_moves[MAX_VALID_MOVES], unsigned
 
 CHESSDEF bool is_legal_move(char board[64], const Move move, Castle castle, Move last_move)
 {
-	Move valid_moves[MAX_VALID_MOVES];
-	unsigned char count;
-	generate_valid_moves(board, valid_moves, &count, BOTH, castle, last_move);
-	return is_move_in_valid_moves(valid_moves, count, move);
+	Position position;
+	position_init(&position, board);
+	return position_is_legal_move(&position, move, BOTH, castle, last_move);
 }
 
 CHESSDEF void sort_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count, int (*cmp[])(Move a, Move b), size_t cmp_count)
@@ -1320,4 +1795,3280 @@ CHESSDEF void sort_moves(Move valid_moves[MAX_VALID_MOVES], unsigned char count,
     } while (swapped);
 }
 
-#endif // CHESS_IMPLEMENTATION
\ No newline at end of file
+static inline void position_put_piece(Position* position, const Square square, const char piece)
+{
+	const Player player = PIECE_PLAYER(piece);
+	const unsigned char type = PIECE_TYPE(piece);
+	const Bitboard bb = SQUARE_BB(square);
+
+	position->board[square] = piece;
+	position->pieces[player][type] |= bb;
+	position->occupied[player] |= bb;
+	position->occupied[BOTH] |= bb;
+	position->key ^= ZOBRIST_PIECES[player][type][square];
+}
+
+static inline void position_remove_piece(Position* position, const Square square)
+{
+	const char piece = position->board[square];
+	if (piece == ' ') return;
+
+	const Player player = PIECE_PLAYER(piece);
+	const unsigned char type = PIECE_TYPE(piece);
+	const Bitboard bb = SQUARE_BB(square);
+
+	position->board[square] = ' ';
+	position->pieces[player][type] &= ~bb;
+	position->occupied[player] &= ~bb;
+	position->occupied[BOTH] &= ~bb;
+	position->key ^= ZOBRIST_PIECES[player][type][square];
+}
+
+// Castle rights kept after a move from or to a square, only the king and rook starting squares drop any
+static const Castle CASTLE_RIGHTS[64] = {
+	0x2F, 0x3F, 0x3F, 0x3F, 0x37, 0x3F, 0x3F, 0x1F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0x3F,
+	0x3D, 0x3F, 0x3F, 0x3F, 0x3E, 0x3F, 0x3F, 0x3B,
+};
+
+// The double pawn push that left `en_passant` behind, which is all the generators need from the last move
+CHESSDEF Move position_en_passant_move(const Position* position)
+{
+	if (position->en_passant == NO_SQUARE) return NO_MOVE;
+
+	// The pushed pawn belongs to the side that is not to move
+	return position->player == BLACK
+		? CREATE_MOVE(position->en_passant + 8, position->en_passant - 8, NORMAL, 0)
+		: CREATE_MOVE(position->en_passant - 8, position->en_passant + 8, NORMAL, 0);
+}
+
+static void position_set_state(Position* position, const Player player, const Castle castle, const Move last_move)
+{
+#ifdef USE_PLAYER_CHECK
+	if (player != WHITE && player != BLACK) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	const Square to = GET_TO(last_move);
+	const bool double_push = ABS(GET_FROM(last_move) - to) == 16 && position->board[to] == (player == WHITE ? 'p' : 'P');
+
+	position->player = player;
+	position->castle = castle;
+	position->en_passant = double_push ? (GET_FROM(last_move) + to) / 2 : NO_SQUARE;
+	position->halfmove_clock = 0;
+	position->ply = 0;
+
+	update_castle(position->board, &position->castle);
+	position->hash = position_hash(position, player, position->castle, position_en_passant_move(position));
+}
+
+CHESSDEF void position_init(Position* position, const char board[64])
+{
+	init_attack_tables();
+
+	memset(position->board, ' ', sizeof(position->board));
+	position->occupied[BOTH] = 0;
+	position->key = 0;
+	position->history = NULL;
+	position->history_size = 0;
+
+	// One vector scan per piece, only the squares that hold it are visited
+	for (unsigned char player = BLACK; player <= WHITE; player++)
+	{
+		position->occupied[player] = 0;
+
+		for (unsigned char type = PIECE_PAWN; type <= PIECE_KING; type++)
+		{
+			const char piece = PIECE_CHAR(player, type);
+			const Bitboard mask = board_piece_mask(board, piece);
+
+			position->pieces[player][type] = mask;
+			position->occupied[player] |= mask;
+			for (Bitboard squares = mask; squares; POP_LSB(squares))
+			{
+				position->board[LSB(squares)] = piece;
+				position->key ^= ZOBRIST_PIECES[player][type][LSB(squares)];
+			}
+		}
+
+		position->occupied[BOTH] |= position->occupied[player];
+
+		const Bitboard king = position->pieces[player][PIECE_KING];
+		position->king_square[player] = king ? LSB(king) : NO_SQUARE;
+	}
+
+	position_set_state(position, WHITE, INITIAL_CASTLE, NO_MOVE);
+}
+
+CHESSDEF void position_set(Position* position, const char board[64], const Player player, const Castle castle, const Move last_move)
+{
+	position_init(position, board);
+	position_set_state(position, player, castle, last_move);
+}
+
+CHESSDEF void position_make_move(Position* position, const Move move)
+{
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const char piece = position->board[from];
+
+	switch (GET_TYPE(move))
+	{
+	case NORMAL:
+		{
+			position_remove_piece(position, to);
+			position_remove_piece(position, from);
+			position_put_piece(position, to, piece);
+
+			if (PIECE_TYPE(piece) == PIECE_KING) position->king_square[PIECE_PLAYER(piece)] = to;
+		}
+		break;
+
+	case PROMOTION:
+		{
+			if (IS_INVALID_PROMOTION_PIECE(GET_PROM(move)))
+			{
+				UNREACHABLE;
+			}
+
+			position_remove_piece(position, to);
+			position_remove_piece(position, from);
+			position_put_piece(position, to, PIECE_CHAR(PIECE_PLAYER(piece), PROMOTION_TO_PIECE(GET_PROM(move))));
+		}
+		break;
+
+	case CASTLE:
+		{
+			if (piece == 'K' || piece == 'k')
+			{
+				const bool is_white = (piece == 'K');
+				const Square rook_from = is_white ? (to == 62 ? 63 : 56) : (to == 6 ? 7 : 0);
+				const Square rook_to = is_white ? (to == 62 ? 61 : 59) : (to == 6 ? 5 : 3);
+
+				position_remove_piece(position, from);
+				position_put_piece(position, to, piece);
+				position_remove_piece(position, rook_from);
+				position_put_piece(position, rook_to, is_white ? 'R' : 'r');
+				position->king_square[is_white ? WHITE : BLACK] = to;
+			}
+		}
+		break;
+
+	case EN_PASSANT:
+		{
+			position_remove_piece(position, from);
+			position_put_piece(position, to, piece);
+			position_remove_piece(position, to - (piece == 'P' ? -1 : 1) * 8);
+		}
+		break;
+
+	default:
+		UNREACHABLE;
+	}
+}
+
+CHESSDEF void position_undo_move(Position* position, const Move move, const char captured_piece)
+{
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const char moved_piece = position->board[to];
+
+	switch (GET_TYPE(move))
+	{
+	case NORMAL:
+		{
+			position_remove_piece(position, to);
+			position_put_piece(position, from, moved_piece);
+			if (captured_piece != ' ') position_put_piece(position, to, captured_piece);
+
+			if (PIECE_TYPE(moved_piece) == PIECE_KING) position->king_square[PIECE_PLAYER(moved_piece)] = from;
+		}
+		break;
+
+	case PROMOTION:
+		{
+			position_remove_piece(position, to);
+			position_put_piece(position, from, IS_WHITE_PIECE(moved_piece) ? 'P' : 'p');
+			if (captured_piece != ' ') position_put_piece(position, to, captured_piece);
+		}
+		break;
+
+	case CASTLE:
+		{
+			if (moved_piece == 'K' || moved_piece == 'k')
+			{
+				const bool is_white = (moved_piece == 'K');
+				const Square rook_from = is_white ? (to == 62 ? 63 : 56) : (to == 6 ? 7 : 0);
+				const Square rook_to = is_white ? (to == 62 ? 61 : 59) : (to == 6 ? 5 : 3);
+
+				position_remove_piece(position, to);
+				position_put_piece(position, is_white ? 60 : 4, moved_piece);
+				position_remove_piece(position, rook_to);
+				position_put_piece(position, rook_from, is_white ? 'R' : 'r');
+				position->king_square[is_white ? WHITE : BLACK] = is_white ? 60 : 4;
+			}
+		}
+		break;
+
+	case EN_PASSANT:
+		{
+			position_remove_piece(position, to);
+			position_put_piece(position, from, moved_piece);
+			position_put_piece(position, to - (moved_piece == 'P' ? -1 : 1) * 8, moved_piece == 'P' ? 'p' : 'P');
+		}
+		break;
+
+	default:
+		UNREACHABLE;
+	}
+}
+
+// Zobrist key of the en passant square, only when the side to move can take on it
+static inline Bitboard position_en_passant_key(const Position* position)
+{
+	if (position->en_passant == NO_SQUARE) return 0;
+
+	const Bitboard pawns = position->pieces[position->player][PIECE_PAWN];
+	return (PAWN_ATTACKS[SWITCH_PLAYER(position->player)][position->en_passant] & pawns) ? ZOBRIST_EN_PASSANT[GET_COL(position->en_passant)] : 0;
+}
+
+static inline void position_do_move(Position* position, const Move move, PositionUndo* undo)
+{
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const char piece = position->board[from];
+
+	undo->move = move;
+	undo->captured_piece = position->board[to];
+	undo->castle = position->castle;
+	undo->en_passant = position->en_passant;
+	undo->halfmove_clock = position->halfmove_clock;
+	undo->hash = position->hash;
+
+	// Everything but the pieces is replaced, the piece part follows the key
+	const Bitboard hash = position->hash ^ position->key ^ ZOBRIST_CASTLE[position->castle] ^ position_en_passant_key(position);
+
+	position_make_move(position, move);
+
+	const bool pawn_move = PIECE_TYPE(piece) == PIECE_PAWN;
+	position->halfmove_clock = pawn_move || undo->captured_piece != ' ' ? 0 : position->halfmove_clock + 1;
+	position->castle &= CASTLE_RIGHTS[from] & CASTLE_RIGHTS[to];
+	if (GET_TYPE(move) == CASTLE) position->castle &= CASTLE_RIGHTS[GET_COL(to) == 6 ? to + 1 : to - 2]; // the rook left its square too
+	position->en_passant = pawn_move && ABS(from - to) == 16 ? (from + to) / 2 : NO_SQUARE;
+	position->player = SWITCH_PLAYER(position->player);
+	position->hash = hash ^ position->key ^ ZOBRIST_CASTLE[position->castle] ^ ZOBRIST_BLACK_TO_MOVE ^ position_en_passant_key(position);
+}
+
+static inline void position_undo_state(Position* position, const PositionUndo* undo)
+{
+	position_undo_move(position, undo->move, undo->captured_piece);
+
+	position->castle = undo->castle;
+	position->en_passant = undo->en_passant;
+	position->halfmove_clock = undo->halfmove_clock;
+	position->hash = undo->hash;
+	position->player = SWITCH_PLAYER(position->player);
+}
+
+CHESSDEF void position_set_history(Position* position, PositionUndo history[], const unsigned short size)
+{
+	position->history = history;
+	position->history_size = size;
+	position->ply = 0;
+}
+
+CHESSDEF void position_push(Position* position, const Move move)
+{
+	assert(position->ply < position->history_size && "Position undo stack is full or missing");
+	position_do_move(position, move, &position->history[position->ply++]);
+}
+
+CHESSDEF Move position_pop(Position* position)
+{
+	if (position->ply == 0) return NO_MOVE;
+
+	const PositionUndo* undo = &position->history[--position->ply];
+	position_undo_state(position, undo);
+	return undo->move;
+}
+
+// Pieces of `player` attacking `square` when the board occupancy is `occupied`
+static inline Bitboard position_attackers(const Position* position, const Square square, const Bitboard occupied, const Player player)
+{
+	const Bitboard* pieces = position->pieces[player];
+
+	// A pawn of `player` attacks `square` iff a pawn of the other player standing on `square` would attack it back
+	return (PAWN_ATTACKS[SWITCH_PLAYER(player)][square] & pieces[PIECE_PAWN]) |
+	       (KNIGHT_ATTACKS[square] & pieces[PIECE_KNIGHT]) |
+	       (KING_ATTACKS[square] & pieces[PIECE_KING]) |
+	       (bishop_attacks(square, occupied) & (pieces[PIECE_BISHOP] | pieces[PIECE_QUEEN])) |
+	       (rook_attacks(square, occupied) & (pieces[PIECE_ROOK] | pieces[PIECE_QUEEN]));
+}
+
+CHESSDEF bool position_is_attacked(const Position* position, const Square square, const Player player)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (player == BOTH)
+	{
+		return position_is_attacked(position, square, WHITE) || position_is_attacked(position, square, BLACK);
+	}
+
+	return position_attackers(position, square, position->occupied[BOTH], player) != 0;
+}
+
+CHESSDEF bool position_is_in_check(const Position* position, const Player player)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (player == BOTH)
+	{
+		return position_is_in_check(position, WHITE) || position_is_in_check(position, BLACK);
+	}
+
+	const Square king_square = position->king_square[player];
+	if (king_square == NO_SQUARE) return false;
+
+	return position_is_attacked(position, king_square, SWITCH_PLAYER(player));
+}
+
+static inline void position_add_moves(Move valid_moves[MAX_VALID_MOVES], const Square from, Bitboard targets, unsigned char* count)
+{
+	for (; targets; POP_LSB(targets))
+	{
+		valid_moves[(*count)++] = CREATE_MOVE(from, LSB(targets), NORMAL, 0);
+	}
+}
+
+static inline void position_add_pawn_moves(Move valid_moves[MAX_VALID_MOVES], const Square from, Bitboard targets, unsigned char* count)
+{
+	for (; targets; POP_LSB(targets))
+	{
+		const Square to = LSB(targets);
+		if (GET_ROW(to) == 0 || GET_ROW(to) == 7)
+		{
+			for (unsigned char promotion_piece = 0; promotion_piece < 4; ++promotion_piece)
+			{
+				valid_moves[(*count)++] = CREATE_MOVE(from, to, PROMOTION, promotion_piece);
+			}
+		}
+		else
+		{
+			valid_moves[(*count)++] = CREATE_MOVE(from, to, NORMAL, 0);
+		}
+	}
+}
+
+/*
+ * Legal move generation without make/undo per candidate: checkers, pinned pieces and the evasion mask
+ * are computed once, every target set is masked with them. Only king moves and en passant
+ * (discovered checks along the row of both pawns) still test the resulting position.
+ *
+ * `type` selects captures (promotions and en passant included) and/or quiet moves (castling included),
+ * only pieces standing on `from_mask` are generated.
+ */
+static void position_generate_moves(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle, const Move last_move, const unsigned char type, const Bitboard from_mask)
+{
+	const Player opponent = SWITCH_PLAYER(player);
+	const Bitboard* pieces = position->pieces[player];
+	const Bitboard* enemy_pieces = position->pieces[opponent];
+	const Bitboard enemy = position->occupied[opponent];
+	const Bitboard occupied = position->occupied[BOTH];
+	const Bitboard empty = ~occupied;
+	const Bitboard target_mask = ((type & GENERATE_CAPTURES) ? enemy : 0) | ((type & GENERATE_QUIETS) ? empty : 0);
+
+	// Without a king (test positions) every pseudo-legal move is legal
+	const Square king_square = position->king_square[player];
+	Bitboard checkers = 0, pinned = 0, check_mask = ~0ULL;
+
+	if (king_square != NO_SQUARE)
+	{
+		checkers = position_attackers(position, king_square, occupied, opponent);
+
+		if (POP_COUNT(checkers) > 1) check_mask = 0;
+		else if (checkers) check_mask = checkers | BETWEEN[king_square][LSB(checkers)];
+
+		Bitboard snipers = (rook_attacks(king_square, 0) & (enemy_pieces[PIECE_ROOK] | enemy_pieces[PIECE_QUEEN])) |
+		                   (bishop_attacks(king_square, 0) & (enemy_pieces[PIECE_BISHOP] | enemy_pieces[PIECE_QUEEN]));
+		for (; snipers; POP_LSB(snipers))
+		{
+			const Bitboard blockers = BETWEEN[king_square][LSB(snipers)] & occupied;
+			if (blockers && !(blockers & (blockers - 1))) pinned |= blockers & position->occupied[player];
+		}
+
+		// King moves, the king itself is removed so it cannot hide behind its own square
+		if (from_mask & SQUARE_BB(king_square))
+		{
+			for (Bitboard targets = KING_ATTACKS[king_square] & target_mask; targets; POP_LSB(targets))
+			{
+				const Square to = LSB(targets);
+				if (!position_attackers(position, to, occupied ^ SQUARE_BB(king_square), opponent))
+				{
+					valid_moves[(*count)++] = CREATE_MOVE(king_square, to, NORMAL, 0);
+				}
+			}
+		}
+
+		// Double check, only the king can move
+		if (!check_mask) return;
+	}
+
+	// Pawns, every promotion counts as a capture so quiet moves never change material
+	const char direction = player == WHITE ? -8 : 8;
+	const Bitboard promotion_rows = ROW_BB(0) | ROW_BB(7);
+	for (Bitboard pawns = pieces[PIECE_PAWN] & from_mask; pawns; POP_LSB(pawns))
+	{
+		const Square square = LSB(pawns);
+		const Square target_square = square + direction;
+		Bitboard pushes = 0, targets = 0;
+
+		if (IS_VALID_SQUARE(target_square) && (empty & SQUARE_BB(target_square)))
+		{
+			pushes = SQUARE_BB(target_square);
+
+			// Double move from starting position
+			if (GET_ROW(square) == (player == WHITE ? 6 : 1) && (empty & SQUARE_BB(square + 2 * direction)))
+			{
+				pushes |= SQUARE_BB(square + 2 * direction);
+			}
+		}
+
+		if (type & GENERATE_CAPTURES) targets |= (PAWN_ATTACKS[player][square] & enemy) | (pushes & promotion_rows);
+		if (type & GENERATE_QUIETS) targets |= pushes & ~promotion_rows;
+
+		targets &= check_mask;
+		if (pinned & SQUARE_BB(square)) targets &= LINE[king_square][square];
+		position_add_pawn_moves(valid_moves, square, targets, count);
+
+		// En passant, tested on the resulting occupancy because both pawns leave the same row
+		if ((type & GENERATE_CAPTURES) &&
+			last_move != NO_MOVE &&
+			ABS(GET_FROM(last_move) - GET_TO(last_move)) == 16 &&
+			position->board[GET_TO(last_move)] == PIECE_CHAR(opponent, PIECE_PAWN) &&
+			GET_ROW(square) == (player == WHITE ? 3 : 4) &&
+			ABS(GET_COL(square) - GET_COL(GET_TO(last_move))) == 1)
+		{
+			const Square captured_square = GET_TO(last_move);
+			const Square to = captured_square + direction;
+
+			if (king_square == NO_SQUARE ||
+				!(position_attackers(position, king_square, (occupied ^ SQUARE_BB(square) ^ SQUARE_BB(captured_square)) | SQUARE_BB(to), opponent) & ~SQUARE_BB(captured_square)))
+			{
+				valid_moves[(*count)++] = CREATE_MOVE(square, to, EN_PASSANT, 0);
+			}
+		}
+	}
+
+	for (Bitboard knights = pieces[PIECE_KNIGHT] & from_mask & ~pinned; knights; POP_LSB(knights))
+	{
+		const Square square = LSB(knights);
+		position_add_moves(valid_moves, square, KNIGHT_ATTACKS[square] & target_mask & check_mask, count);
+	}
+
+	for (Bitboard bishops = (pieces[PIECE_BISHOP] | pieces[PIECE_QUEEN]) & from_mask; bishops; POP_LSB(bishops))
+	{
+		const Square square = LSB(bishops);
+		Bitboard targets = bishop_attacks(square, occupied) & target_mask & check_mask;
+		if (pinned & SQUARE_BB(square)) targets &= LINE[king_square][square];
+		position_add_moves(valid_moves, square, targets, count);
+	}
+
+	for (Bitboard rooks = (pieces[PIECE_ROOK] | pieces[PIECE_QUEEN]) & from_mask; rooks; POP_LSB(rooks))
+	{
+		const Square square = LSB(rooks);
+		Bitboard targets = rook_attacks(square, occupied) & target_mask & check_mask;
+		if (pinned & SQUARE_BB(square)) targets &= LINE[king_square][square];
+		position_add_moves(valid_moves, square, targets, count);
+	}
+
+	// Castling moves, the king ends on a square that is tested to be safe
+	if (checkers || king_square == NO_SQUARE || !(type & GENERATE_QUIETS)) return;
+
+	if (player == WHITE && (from_mask & SQUARE_BB(60)))
+	{
+		if ((empty & (SQUARE_BB(61) | SQUARE_BB(62))) == (SQUARE_BB(61) | SQUARE_BB(62)) &&
+			GET_CASTLE_WK(castle) && GET_CASTLE_WR2(castle) &&
+			!position_is_attacked(position, 61, opponent) && !position_is_attacked(position, 62, opponent))
+		{
+			valid_moves[(*count)++] = CREATE_MOVE(60, 62, CASTLE, 0);
+		}
+
+		if ((empty & (SQUARE_BB(57) | SQUARE_BB(58) | SQUARE_BB(59))) == (SQUARE_BB(57) | SQUARE_BB(58) | SQUARE_BB(59)) &&
+			GET_CASTLE_WK(castle) && GET_CASTLE_WR1(castle) &&
+			!position_is_attacked(position, 58, opponent) && !position_is_attacked(position, 59, opponent))
+		{
+			valid_moves[(*count)++] = CREATE_MOVE(60, 58, CASTLE, 0);
+		}
+	}
+	else if (player == BLACK && (from_mask & SQUARE_BB(4)))
+	{
+		if ((empty & (SQUARE_BB(5) | SQUARE_BB(6))) == (SQUARE_BB(5) | SQUARE_BB(6)) &&
+			GET_CASTLE_BK(castle) && GET_CASTLE_BR2(castle) &&
+			!position_is_attacked(position, 5, opponent) && !position_is_attacked(position, 6, opponent))
+		{
+			valid_moves[(*count)++] = CREATE_MOVE(4, 6, CASTLE, 0);
+		}
+
+		if ((empty & (SQUARE_BB(1) | SQUARE_BB(2) | SQUARE_BB(3))) == (SQUARE_BB(1) | SQUARE_BB(2) | SQUARE_BB(3)) &&
+			GET_CASTLE_BK(castle) && GET_CASTLE_BR1(castle) &&
+			!position_is_attacked(position, 2, opponent) && !position_is_attacked(position, 3, opponent))
+		{
+			valid_moves[(*count)++] = CREATE_MOVE(4, 2, CASTLE, 0);
+		}
+	}
+}
+
+// Handles BOTH players and the evasions-only mode on top of position_generate_moves
+static void position_generate(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle, const Move last_move, const unsigned char type)
+{
+	*count = 0;
+
+	if (player == BOTH)
+	{
+		unsigned char white_count = 0, black_count = 0;
+
+		position_generate(position, valid_moves, &white_count, WHITE, castle, last_move, type);
+		position_generate(position, valid_moves + white_count, &black_count, BLACK, castle, last_move, type);
+
+		*count = white_count + black_count;
+		return;
+	}
+
+	if (type == GENERATE_EVASIONS)
+	{
+		// In check every generated move already is a king move, a block or a capture of the checker
+		if (position_is_in_check(position, player))
+		{
+			position_generate_moves(position, valid_moves, count, player, 0, last_move, GENERATE_ALL, ~0ULL);
+		}
+		return;
+	}
+
+	position_generate_moves(position, valid_moves, count, player, castle, last_move, type, ~0ULL);
+}
+
+CHESSDEF void position_generate_valid_moves(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle, const Move last_move)
+{
+	position_generate(position, valid_moves, count, player, castle, last_move, GENERATE_ALL);
+}
+
+CHESSDEF void position_generate_captures(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move)
+{
+	position_generate(position, valid_moves, count, player, 0, last_move, GENERATE_CAPTURES);
+}
+
+CHESSDEF void position_generate_quiets(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Castle castle)
+{
+	position_generate(position, valid_moves, count, player, castle, NO_MOVE, GENERATE_QUIETS);
+}
+
+CHESSDEF void position_generate_evasions(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count, const Player player, const Move last_move)
+{
+	position_generate(position, valid_moves, count, player, 0, last_move, GENERATE_EVASIONS);
+}
+
+// Every promotion target stands for four moves
+static inline unsigned int count_pawn_targets(const Bitboard targets)
+{
+	const Bitboard promotions = targets & (ROW_BB(0) | ROW_BB(7));
+	return POP_COUNT(targets ^ promotions) + 4 * POP_COUNT(promotions);
+}
+
+/*
+ * Counts what position_generate_moves(..., GENERATE_ALL, ~0ULL) would generate without writing a move list,
+ * target sets are popcounted and pawns that are not pinned are pushed and captured set-wise.
+ */
+static unsigned int position_count_moves(const Position* position, const Player player, const Castle castle, const Move last_move)
+{
+	const Player opponent = SWITCH_PLAYER(player);
+	const Bitboard* pieces = position->pieces[player];
+	const Bitboard* enemy_pieces = position->pieces[opponent];
+	const Bitboard enemy = position->occupied[opponent];
+	const Bitboard occupied = position->occupied[BOTH];
+	const Bitboard empty = ~occupied;
+	const Bitboard target_mask = ~position->occupied[player];
+
+	const Square king_square = position->king_square[player];
+	Bitboard checkers = 0, pinned = 0, check_mask = ~0ULL;
+	unsigned int count = 0;
+
+	if (king_square != NO_SQUARE)
+	{
+		checkers = position_attackers(position, king_square, occupied, opponent);
+
+		if (POP_COUNT(checkers) > 1) check_mask = 0;
+		else if (checkers) check_mask = checkers | BETWEEN[king_square][LSB(checkers)];
+
+		Bitboard snipers = (rook_attacks(king_square, 0) & (enemy_pieces[PIECE_ROOK] | enemy_pieces[PIECE_QUEEN])) |
+		                   (bishop_attacks(king_square, 0) & (enemy_pieces[PIECE_BISHOP] | enemy_pieces[PIECE_QUEEN]));
+		for (; snipers; POP_LSB(snipers))
+		{
+			const Bitboard blockers = BETWEEN[king_square][LSB(snipers)] & occupied;
+			if (blockers && !(blockers & (blockers - 1))) pinned |= blockers & position->occupied[player];
+		}
+
+		for (Bitboard targets = KING_ATTACKS[king_square] & target_mask; targets; POP_LSB(targets))
+		{
+			if (!position_attackers(position, LSB(targets), occupied ^ SQUARE_BB(king_square), opponent)) count++;
+		}
+
+		if (!check_mask) return count;
+	}
+
+	// Pawns that are not pinned, all at once
+	const Bitboard pawns = pieces[PIECE_PAWN] & ~pinned;
+	if (player == WHITE)
+	{
+		const Bitboard single = (pawns >> 8) & empty;
+		count += count_pawn_targets(single & check_mask);
+		count += POP_COUNT(((single & ROW_BB(5)) >> 8) & empty & check_mask);
+		count += count_pawn_targets(((pawns >> 9) & ~FILE_H_BB) & enemy & check_mask);
+		count += count_pawn_targets(((pawns >> 7) & ~FILE_A_BB) & enemy & check_mask);
+	}
+	else
+	{
+		const Bitboard single = (pawns << 8) & empty;
+		count += count_pawn_targets(single & check_mask);
+		count += POP_COUNT(((single & ROW_BB(2)) << 8) & empty & check_mask);
+		count += count_pawn_targets(((pawns << 7) & ~FILE_H_BB) & enemy & check_mask);
+		count += count_pawn_targets(((pawns << 9) & ~FILE_A_BB) & enemy & check_mask);
+	}
+
+	// Pinned pawns move along the pin line only
+	const char direction = player == WHITE ? -8 : 8;
+	for (Bitboard pinned_pawns = pieces[PIECE_PAWN] & pinned; pinned_pawns; POP_LSB(pinned_pawns))
+	{
+		const Square square = LSB(pinned_pawns);
+		const Square target_square = square + direction;
+		Bitboard targets = PAWN_ATTACKS[player][square] & enemy;
+
+		if (IS_VALID_SQUARE(target_square) && (empty & SQUARE_BB(target_square)))
+		{
+			targets |= SQUARE_BB(target_square);
+			if (GET_ROW(square) == (player == WHITE ? 6 : 1) && (empty & SQUARE_BB(square + 2 * direction)))
+			{
+				targets |= SQUARE_BB(square + 2 * direction);
+			}
+		}
+
+		count += count_pawn_targets(targets & check_mask & LINE[king_square][square]);
+	}
+
+	// En passant, same test on the resulting occupancy as in position_generate_moves
+	if (last_move != NO_MOVE &&
+		ABS(GET_FROM(last_move) - GET_TO(last_move)) == 16 &&
+		position->board[GET_TO(last_move)] == PIECE_CHAR(opponent, PIECE_PAWN))
+	{
+		const Square captured_square = GET_TO(last_move);
+		const Square to = captured_square + direction;
+
+		const Bitboard file = FILE_A_BB << GET_COL(captured_square);
+		const Bitboard neighbours = ((file >> 1) & ~FILE_H_BB) | ((file << 1) & ~FILE_A_BB);
+
+		for (Bitboard capturers = pieces[PIECE_PAWN] & ROW_BB(player == WHITE ? 3 : 4) & neighbours; capturers; POP_LSB(capturers))
+		{
+			const Square square = LSB(capturers);
+			if (king_square == NO_SQUARE ||
+				!(position_attackers(position, king_square, (occupied ^ SQUARE_BB(square) ^ SQUARE_BB(captured_square)) | SQUARE_BB(to), opponent) & ~SQUARE_BB(captured_square)))
+			{
+				count++;
+			}
+		}
+	}
+
+	for (Bitboard knights = pieces[PIECE_KNIGHT] & ~pinned; knights; POP_LSB(knights))
+	{
+		count += POP_COUNT(KNIGHT_ATTACKS[LSB(knights)] & target_mask & check_mask);
+	}
+
+	for (Bitboard bishops = pieces[PIECE_BISHOP] | pieces[PIECE_QUEEN]; bishops; POP_LSB(bishops))
+	{
+		const Square square = LSB(bishops);
+		Bitboard targets = bishop_attacks(square, occupied) & target_mask & check_mask;
+		if (pinned & SQUARE_BB(square)) targets &= LINE[king_square][square];
+		count += POP_COUNT(targets);
+	}
+
+	for (Bitboard rooks = pieces[PIECE_ROOK] | pieces[PIECE_QUEEN]; rooks; POP_LSB(rooks))
+	{
+		const Square square = LSB(rooks);
+		Bitboard targets = rook_attacks(square, occupied) & target_mask & check_mask;
+		if (pinned & SQUARE_BB(square)) targets &= LINE[king_square][square];
+		count += POP_COUNT(targets);
+	}
+
+	if (checkers || king_square == NO_SQUARE) return count;
+
+	if (player == WHITE)
+	{
+		count += (empty & (SQUARE_BB(61) | SQUARE_BB(62))) == (SQUARE_BB(61) | SQUARE_BB(62)) &&
+			GET_CASTLE_WK(castle) && GET_CASTLE_WR2(castle) &&
+			!position_is_attacked(position, 61, opponent) && !position_is_attacked(position, 62, opponent);
+
+		count += (empty & (SQUARE_BB(57) | SQUARE_BB(58) | SQUARE_BB(59))) == (SQUARE_BB(57) | SQUARE_BB(58) | SQUARE_BB(59)) &&
+			GET_CASTLE_WK(castle) && GET_CASTLE_WR1(castle) &&
+			!position_is_attacked(position, 58, opponent) && !position_is_attacked(position, 59, opponent);
+	}
+	else
+	{
+		count += (empty & (SQUARE_BB(5) | SQUARE_BB(6))) == (SQUARE_BB(5) | SQUARE_BB(6)) &&
+			GET_CASTLE_BK(castle) && GET_CASTLE_BR2(castle) &&
+			!position_is_attacked(position, 5, opponent) && !position_is_attacked(position, 6, opponent);
+
+		count += (empty & (SQUARE_BB(1) | SQUARE_BB(2) | SQUARE_BB(3))) == (SQUARE_BB(1) | SQUARE_BB(2) | SQUARE_BB(3)) &&
+			GET_CASTLE_BK(castle) && GET_CASTLE_BR1(castle) &&
+			!position_is_attacked(position, 2, opponent) && !position_is_attacked(position, 3, opponent);
+	}
+
+	return count;
+}
+
+CHESSDEF unsigned int position_count_valid_moves(const Position* position, const Player player, const Castle castle, const Move last_move)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (player == BOTH)
+	{
+		return position_count_moves(position, WHITE, castle, last_move) + position_count_moves(position, BLACK, castle, last_move);
+	}
+
+	return position_count_moves(position, player, castle, last_move);
+}
+
+// Castling, under the same conditions position_generate_moves checks
+static bool position_is_legal_castle(const Position* position, const Move move, const Player player, const Castle castle)
+{
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const Player opponent = SWITCH_PLAYER(player);
+	const Square king_square = position->king_square[player];
+
+	if (GET_PROM(move) != 0 || king_square == NO_SQUARE || from != (player == WHITE ? 60 : 4)) return false;
+
+	const bool king_side = (to == from + 2);
+	if (!king_side && to != from - 2) return false;
+
+	const bool rights = player == WHITE
+		? (GET_CASTLE_WK(castle) && (king_side ? GET_CASTLE_WR2(castle) : GET_CASTLE_WR1(castle)))
+		: (GET_CASTLE_BK(castle) && (king_side ? GET_CASTLE_BR2(castle) : GET_CASTLE_BR1(castle)));
+	const Bitboard path = king_side ? SQUARE_BB(from + 1) | SQUARE_BB(from + 2) : SQUARE_BB(from - 1) | SQUARE_BB(from - 2) | SQUARE_BB(from - 3);
+
+	return rights && !(position->occupied[BOTH] & path) &&
+	       !position_is_attacked(position, king_square, opponent) &&
+	       !position_is_attacked(position, (from + to) / 2, opponent) && !position_is_attacked(position, to, opponent);
+}
+
+/*
+ * Single move legality without generating anything: the move has to be pseudo-legal for the piece on its
+ * from square, then the own king must not be attacked on the occupancy after the move.
+ * Same answer as looking the move up in position_generate_valid_moves.
+ */
+CHESSDEF bool position_is_legal_move(const Position* position, const Move move, const Player player, const Castle castle, const Move last_move)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const char piece = position->board[from];
+
+	// Castling is generated from the king's starting square, whatever stands there
+	if (GET_TYPE(move) == CASTLE)
+	{
+		if (player == BOTH) return position_is_legal_castle(position, move, WHITE, castle) || position_is_legal_castle(position, move, BLACK, castle);
+		return position_is_legal_castle(position, move, player, castle);
+	}
+
+	if (piece == ' ' || (player != BOTH && PIECE_PLAYER(piece) != player)) return false;
+
+	const Player own = PIECE_PLAYER(piece);
+	const Player opponent = SWITCH_PLAYER(own);
+	const Bitboard occupied = position->occupied[BOTH];
+	const Bitboard to_bb = SQUARE_BB(to);
+	Square king_square = position->king_square[own];
+	Bitboard after = (occupied ^ SQUARE_BB(from)) | to_bb;
+	Bitboard captured = to_bb;
+
+	// The square an en passant capture lands on is checked by the generator only through the last move
+	if (GET_TYPE(move) != EN_PASSANT && (position->occupied[own] & to_bb)) return false;
+
+	switch (PIECE_TYPE(piece))
+	{
+	case PIECE_PAWN:
+		{
+			const char direction = own == WHITE ? -8 : 8;
+
+			if (GET_TYPE(move) == EN_PASSANT)
+			{
+				if (GET_PROM(move) != 0 ||
+					last_move == NO_MOVE ||
+					ABS(GET_FROM(last_move) - GET_TO(last_move)) != 16 ||
+					position->board[GET_TO(last_move)] != PIECE_CHAR(opponent, PIECE_PAWN) ||
+					GET_ROW(from) != (own == WHITE ? 3 : 4) ||
+					ABS(GET_COL(from) - GET_COL(GET_TO(last_move))) != 1 ||
+					to != GET_TO(last_move) + direction)
+				{
+					return false;
+				}
+
+				captured = SQUARE_BB(GET_TO(last_move));
+				after ^= captured;
+				break;
+			}
+
+			// Every move onto the last row is a promotion and only those are
+			if ((GET_TYPE(move) == PROMOTION) != (GET_ROW(to) == 0 || GET_ROW(to) == 7)) return false;
+			if (GET_TYPE(move) == NORMAL && GET_PROM(move) != 0) return false;
+
+			const bool push = to == from + direction && !(occupied & to_bb);
+			const bool double_push = to == from + 2 * direction && GET_ROW(from) == (own == WHITE ? 6 : 1) &&
+			                         !(occupied & (to_bb | SQUARE_BB(from + direction)));
+			const bool capture = (PAWN_ATTACKS[own][from] & position->occupied[opponent] & to_bb) != 0;
+
+			if (!push && !double_push && !capture) return false;
+		}
+		break;
+
+	case PIECE_KNIGHT:
+		if (GET_TYPE(move) != NORMAL || GET_PROM(move) != 0 || !(KNIGHT_ATTACKS[from] & to_bb)) return false;
+		break;
+
+	case PIECE_BISHOP:
+		if (GET_TYPE(move) != NORMAL || GET_PROM(move) != 0 || !(bishop_attacks(from, occupied) & to_bb)) return false;
+		break;
+
+	case PIECE_ROOK:
+		if (GET_TYPE(move) != NORMAL || GET_PROM(move) != 0 || !(rook_attacks(from, occupied) & to_bb)) return false;
+		break;
+
+	case PIECE_QUEEN:
+		if (GET_TYPE(move) != NORMAL || GET_PROM(move) != 0 || !((bishop_attacks(from, occupied) | rook_attacks(from, occupied)) & to_bb)) return false;
+		break;
+
+	case PIECE_KING:
+		// Only the king on king_square moves, like in position_generate_moves
+		if (GET_TYPE(move) != NORMAL || GET_PROM(move) != 0 || from != king_square || !(KING_ATTACKS[from] & to_bb)) return false;
+		king_square = to;
+		break;
+
+	default:
+		UNREACHABLE;
+	}
+
+	// Without a king (test positions) every pseudo-legal move is legal
+	if (king_square == NO_SQUARE) return true;
+
+	return !(position_attackers(position, king_square, after, opponent) & ~captured);
+}
+
+CHESSDEF void position_check_info(const Position* position, const Player player, CheckInfo* info)
+{
+#ifdef USE_PLAYER_CHECK
+	if (player != WHITE && player != BLACK) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	const Bitboard* pieces = position->pieces[player];
+	const Bitboard occupied = position->occupied[BOTH];
+	const Square king_square = position->king_square[SWITCH_PLAYER(player)];
+
+	info->player = player;
+	info->king_square = king_square;
+	info->discovered = 0;
+	memset(info->check_squares, 0, sizeof(info->check_squares));
+
+	if (king_square == NO_SQUARE) return;
+
+	info->check_squares[PIECE_PAWN] = PAWN_ATTACKS[SWITCH_PLAYER(player)][king_square];
+	info->check_squares[PIECE_KNIGHT] = KNIGHT_ATTACKS[king_square];
+	info->check_squares[PIECE_BISHOP] = bishop_attacks(king_square, occupied);
+	info->check_squares[PIECE_ROOK] = rook_attacks(king_square, occupied);
+	info->check_squares[PIECE_QUEEN] = info->check_squares[PIECE_BISHOP] | info->check_squares[PIECE_ROOK];
+
+	// Own sliders looking at the enemy king through exactly one own piece
+	Bitboard snipers = (rook_attacks(king_square, 0) & (pieces[PIECE_ROOK] | pieces[PIECE_QUEEN])) |
+	                   (bishop_attacks(king_square, 0) & (pieces[PIECE_BISHOP] | pieces[PIECE_QUEEN]));
+	for (; snipers; POP_LSB(snipers))
+	{
+		const Bitboard blockers = BETWEEN[king_square][LSB(snipers)] & occupied;
+		if (blockers && !(blockers & (blockers - 1))) info->discovered |= blockers & position->occupied[player];
+	}
+}
+
+// Own sliders attacking the enemy king once the board occupancy is `occupied`
+static inline bool position_slider_check(const Position* position, const CheckInfo* info, const Bitboard occupied)
+{
+	const Bitboard* pieces = position->pieces[info->player];
+
+	return (rook_attacks(info->king_square, occupied) & (pieces[PIECE_ROOK] | pieces[PIECE_QUEEN])) ||
+	       (bishop_attacks(info->king_square, occupied) & (pieces[PIECE_BISHOP] | pieces[PIECE_QUEEN]));
+}
+
+CHESSDEF bool position_gives_check(const Position* position, const CheckInfo* info, const Move move)
+{
+	if (info->king_square == NO_SQUARE) return false;
+
+	const Square from = GET_FROM(move);
+	const Square to = GET_TO(move);
+	const Bitboard occupied = position->occupied[BOTH];
+
+	switch (GET_TYPE(move))
+	{
+	case NORMAL:
+		if (info->check_squares[PIECE_TYPE(position->board[from])] & SQUARE_BB(to)) return true;
+		break;
+
+	case PROMOTION:
+		{
+			// The pawn's square is empty afterwards, a new slider may look through it
+			const Bitboard after = occupied ^ SQUARE_BB(from);
+			Bitboard attacks = 0;
+
+			switch (PROMOTION_TO_PIECE(GET_PROM(move)))
+			{
+			case PIECE_KNIGHT: attacks = KNIGHT_ATTACKS[to]; break;
+			case PIECE_BISHOP: attacks = bishop_attacks(to, after); break;
+			case PIECE_ROOK:   attacks = rook_attacks(to, after); break;
+			case PIECE_QUEEN:  attacks = bishop_attacks(to, after) | rook_attacks(to, after); break;
+			default:           UNREACHABLE;
+			}
+
+			if (attacks & SQUARE_BB(info->king_square)) return true;
+		}
+		break;
+
+	case CASTLE:
+		{
+			// Only the rook can give check, the king never leaves the line of a discovered check on its row
+			const Square rook_from = GET_COL(to) == 6 ? to + 1 : to - 2;
+			const Square rook_to = (from + to) / 2;
+			const Bitboard after = (occupied ^ SQUARE_BB(from) ^ SQUARE_BB(rook_from)) | SQUARE_BB(to) | SQUARE_BB(rook_to);
+
+			return (rook_attacks(rook_to, after) & SQUARE_BB(info->king_square)) != 0;
+		}
+
+	case EN_PASSANT:
+		{
+			// Two pawns leave their squares, simply look at the sliders on the resulting occupancy
+			const Square captured_square = to + (info->player == WHITE ? 8 : -8);
+			const Bitboard after = (occupied ^ SQUARE_BB(from) ^ SQUARE_BB(captured_square)) | SQUARE_BB(to);
+
+			return (PAWN_ATTACKS[info->player][to] & SQUARE_BB(info->king_square)) || position_slider_check(position, info, after);
+		}
+
+	default:
+		UNREACHABLE;
+	}
+
+	// Discovered check, unless the piece stays on the line to the king
+	return (info->discovered & SQUARE_BB(from)) && !(LINE[from][info->king_square] & SQUARE_BB(to));
+}
+
+// Most valuable victim, least valuable attacker, promotions are scored by the new piece
+static short move_generator_score(const Position* position, const Move move)
+{
+	static const short values[6] = {1, 3, 3, 5, 9, 0};
+
+	const char victim = position->board[GET_TO(move)];
+	short score = 0;
+
+	if (GET_TYPE(move) == EN_PASSANT) score = values[PIECE_PAWN];
+	else if (victim != ' ') score = values[PIECE_TYPE(victim)];
+	if (GET_TYPE(move) == PROMOTION) score += values[PROMOTION_TO_PIECE(GET_PROM(move))];
+
+	return (short)(score * 8 - PIECE_TYPE(position->board[GET_FROM(move)]));
+}
+
+CHESSDEF void move_generator_init(MoveGenerator* generator, Position* position, const Player player, const Castle castle, const Move last_move, const Move hash_move, const Move killers[2])
+{
+	generator->position = position;
+	generator->player = player;
+	generator->castle = castle;
+	generator->last_move = last_move;
+	generator->hash_move = hash_move;
+	generator->killers[0] = killers ? killers[0] : NO_MOVE;
+	generator->killers[1] = killers && killers[1] != killers[0] ? killers[1] : NO_MOVE;
+	generator->count = generator->index = 0;
+	generator->stage = MOVE_STAGE_HASH_MOVE;
+}
+
+CHESSDEF Move move_generator_next(MoveGenerator* generator)
+{
+	Position* position = generator->position;
+
+	switch (generator->stage)
+	{
+	case MOVE_STAGE_HASH_MOVE:
+		{
+			generator->stage = MOVE_STAGE_GENERATE_CAPTURES;
+			if (generator->hash_move != NO_MOVE &&
+				position_is_legal_move(position, generator->hash_move, generator->player, generator->castle, generator->last_move))
+			{
+				return generator->hash_move;
+			}
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_GENERATE_CAPTURES:
+		{
+			generator->count = generator->index = 0;
+			position_generate_moves(position, generator->moves, &generator->count, generator->player, generator->castle, generator->last_move, GENERATE_CAPTURES, ~0ULL);
+			for (unsigned char i = 0; i < generator->count; i++)
+			{
+				generator->scores[i] = move_generator_score(position, generator->moves[i]);
+			}
+			generator->stage = MOVE_STAGE_CAPTURES;
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_CAPTURES:
+		{
+			// Selection sort, one step per call, consumers that cut off early never sort the rest
+			while (generator->index < generator->count)
+			{
+				unsigned char best = generator->index;
+				for (unsigned char i = generator->index + 1; i < generator->count; i++)
+				{
+					if (generator->scores[i] > generator->scores[best]) best = i;
+				}
+
+				const Move move = generator->moves[best];
+				generator->moves[best] = generator->moves[generator->index];
+				generator->scores[best] = generator->scores[generator->index];
+				generator->index++;
+
+				if (move != generator->hash_move) return move;
+			}
+			generator->index = 0;
+			generator->stage = MOVE_STAGE_KILLERS;
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_KILLERS:
+		{
+			while (generator->index < 2)
+			{
+				const Move killer = generator->killers[generator->index++];
+				// Killers are quiet moves, a capture or promotion there would come twice
+				if (killer != NO_MOVE && killer != generator->hash_move &&
+					(GET_TYPE(killer) == NORMAL || GET_TYPE(killer) == CASTLE) && position->board[GET_TO(killer)] == ' ' &&
+					position_is_legal_move(position, killer, generator->player, generator->castle, generator->last_move))
+				{
+					return killer;
+				}
+			}
+			generator->stage = MOVE_STAGE_GENERATE_QUIETS;
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_GENERATE_QUIETS:
+		{
+			generator->count = generator->index = 0;
+			position_generate_moves(position, generator->moves, &generator->count, generator->player, generator->castle, generator->last_move, GENERATE_QUIETS, ~0ULL);
+			generator->stage = MOVE_STAGE_QUIETS;
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_QUIETS:
+		{
+			while (generator->index < generator->count)
+			{
+				const Move move = generator->moves[generator->index++];
+				if (move != generator->hash_move && move != generator->killers[0] && move != generator->killers[1]) return move;
+			}
+			generator->stage = MOVE_STAGE_DONE;
+		}
+		/* fallthrough */
+
+	case MOVE_STAGE_DONE:
+		return NO_MOVE;
+
+	default:
+		UNREACHABLE;
+	}
+	return NO_MOVE;
+}
+
+CHESSDEF void position_legal_moves(Position* position, Move valid_moves[MAX_VALID_MOVES], unsigned char* count)
+{
+	position_generate_valid_moves(position, valid_moves, count, position->player, position->castle, position_en_passant_move(position));
+}
+
+CHESSDEF unsigned long long position_perft(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (depth == 0) return 1;
+
+	if (player == BOTH)
+	{
+		return position_perft(position, depth, WHITE, castle, last_move, switch_player) +
+			   position_perft(position, depth, BLACK, castle, last_move, switch_player);
+	}
+
+	Move valid_moves[MAX_VALID_MOVES];
+	unsigned char move_count = 0;
+	unsigned long long total_moves = 0;
+
+	Castle new_castle = castle;
+
+	update_castle(position->board, &new_castle);
+
+	// Bulk counting, the last ply only needs the number of legal moves
+	if (depth == 1) return position_count_moves(position, player, new_castle, last_move);
+
+	position_generate_valid_moves(position, valid_moves, &move_count, player, new_castle, last_move);
+
+	for (int i = 0; i < move_count; i++)
+	{
+		const char capture_piece = position->board[GET_TO(valid_moves[i])];
+		position_make_move(position, valid_moves[i]);
+
+		total_moves += position_perft(position, depth - 1, switch_player ? SWITCH_PLAYER(player) : player, new_castle, valid_moves[i], switch_player);
+
+		position_undo_move(position, valid_moves[i], capture_piece);
+	}
+
+	return total_moves;
+}
+
+/*
+ * Perft with statistics, a separate recursion so position_perft keeps its bulk counted last ply and pays
+ * nothing for the counters. Checks come from CheckInfo before the move is made, only checking moves are
+ * made at the last ply to look at the checkers and the replies.
+ */
+static unsigned long long position_perft_stats_node(Position* position, const int depth, const Player player, Castle castle, const Move last_move, const bool switch_player, PerftStats* stats)
+{
+	Move valid_moves[MAX_VALID_MOVES];
+	unsigned char move_count = 0;
+	unsigned long long total_moves = 0;
+	CheckInfo info;
+
+	const Player opponent = SWITCH_PLAYER(player);
+
+	update_castle(position->board, &castle);
+	position_generate_valid_moves(position, valid_moves, &move_count, player, castle, last_move);
+	position_check_info(position, player, &info);
+
+	stats->nodes += move_count;
+	for (int i = 0; i < move_count; i++)
+	{
+		const Move move = valid_moves[i];
+		const Square to = GET_TO(move);
+		const char capture_piece = position->board[to];
+		const bool gives_check = position_gives_check(position, &info, move);
+
+		if (capture_piece != ' ' || GET_TYPE(move) == EN_PASSANT) stats->captures++;
+		if (GET_TYPE(move) == EN_PASSANT) stats->en_passants++;
+		if (GET_TYPE(move) == CASTLE) stats->castles++;
+		if (GET_TYPE(move) == PROMOTION) stats->promotions++;
+
+		if (depth == 1 && !gives_check) continue;
+
+		position_make_move(position, move);
+
+		if (gives_check)
+		{
+			const Bitboard checkers = position_attackers(position, info.king_square, position->occupied[BOTH], player);
+			const Bitboard moved = SQUARE_BB(to) | (GET_TYPE(move) == CASTLE ? SQUARE_BB((GET_FROM(move) + to) / 2) : 0); // the rook for castling
+
+			stats->checks++;
+			if (checkers & (checkers - 1)) stats->double_checks++;
+			else if (checkers & ~moved) stats->discovered_checks++;
+			if (!position_count_moves(position, opponent, 0, move)) stats->checkmates++;
+		}
+
+		if (depth > 1) total_moves += position_perft_stats_node(position, depth - 1, switch_player ? opponent : player, castle, move, switch_player, stats + 1);
+
+		position_undo_move(position, move, capture_piece);
+	}
+
+	return depth > 1 ? total_moves : move_count;
+}
+
+CHESSDEF unsigned long long position_perft_stats(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftStats stats[])
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (depth <= 0) return 1;
+
+	memset(stats, 0, depth * sizeof(PerftStats));
+
+	if (player == BOTH)
+	{
+		return position_perft_stats_node(position, depth, WHITE, castle, last_move, switch_player, stats) +
+			   position_perft_stats_node(position, depth, BLACK, castle, last_move, switch_player, stats);
+	}
+
+	return position_perft_stats_node(position, depth, player, castle, last_move, switch_player, stats);
+}
+
+#define PERFT_ENTRY_NODES(data) ((data) & 0x00FFFFFFFFFFFFFFULL)
+#define PERFT_ENTRY_DEPTH(data) ((int)((data) >> 56))
+
+CHESSDEF bool perft_table_init(PerftTable* table, const size_t megabytes)
+{
+	const size_t bucket_bytes = PERFT_TABLE_BUCKET_SIZE * sizeof(PerftEntry);
+
+	// Largest power of two number of buckets that fits
+	size_t bucket_count = 1;
+	while (bucket_count * 2 * bucket_bytes <= megabytes * 1024 * 1024) bucket_count *= 2;
+
+	table->entries = aligned_alloc(64, bucket_count * bucket_bytes);
+	table->bucket_count = table->entries ? bucket_count : 0;
+	table->mapping = NULL;
+	table->mapping_size = 0;
+	perft_table_clear(table);
+
+	return table->entries != NULL;
+}
+
+CHESSDEF void perft_table_clear(PerftTable* table)
+{
+	if (table->entries) memset(table->entries, 0, table->bucket_count * PERFT_TABLE_BUCKET_SIZE * sizeof(PerftEntry));
+	table->probes = table->hits = table->stores = table->replacements = 0;
+}
+
+CHESSDEF void perft_table_free(PerftTable* table)
+{
+#ifdef CHESS_MMAP_AVAILABLE
+	if (table->mapping != NULL) munmap(table->mapping, table->mapping_size);
+	else
+#endif // CHESS_MMAP_AVAILABLE
+	free(table->entries);
+
+	table->entries = NULL;
+	table->bucket_count = 0;
+	table->mapping = NULL;
+	table->mapping_size = 0;
+}
+
+CHESSDEF double perft_table_hit_rate(const PerftTable* table)
+{
+	return table->probes ? (double)table->hits / (double)table->probes : 0.0;
+}
+
+#ifdef CHESS_MMAP_AVAILABLE
+/*
+ * Perft table files start with this header, the entries follow at PERFT_FILE_HEADER_SIZE. The fingerprint
+ * covers the format version, the Zobrist keys and the counts of a few reference positions, so a file
+ * written by a move generator that counts differently never validates.
+ */
+#define PERFT_FILE_HEADER_SIZE 64
+
+typedef struct
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int entry_size;
+	unsigned long long bucket_count;
+	unsigned long long fingerprint;
+} PerftFileHeader;
+
+static Bitboard perft_table_fingerprint(void)
+{
+	static const char* fens[] = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	};
+
+	Bitboard fingerprint = PERFT_TABLE_VERSION * 0x9E3779B97F4A7C15ULL ^ sizeof(PerftEntry) ^ ((Bitboard)PERFT_TABLE_BUCKET_SIZE << 32);
+
+	Position position;
+	for (unsigned char i = 0; i < sizeof(fens) / sizeof(fens[0]); i++)
+	{
+		char board[64];
+		Player player;
+		Castle castle;
+		Move last_move;
+
+		parse_fen(fens[i], board, &player, &castle, &last_move);
+		position_set(&position, board, player, castle, last_move);
+
+		const Bitboard values[2] = {
+			position_hash(&position, player, position.castle, last_move),
+			position_perft(&position, 3, player, castle, last_move, true),
+		};
+		for (unsigned char j = 0; j < 2; j++)
+		{
+			fingerprint = (fingerprint ^ values[j]) * 0xBF58476D1CE4E5B9ULL;
+			fingerprint ^= fingerprint >> 31;
+		}
+	}
+
+	return fingerprint;
+}
+#endif // CHESS_MMAP_AVAILABLE
+
+CHESSDEF bool perft_table_open(PerftTable* table, const char* path, const size_t megabytes)
+{
+#ifdef CHESS_MMAP_AVAILABLE
+	init_attack_tables();
+
+	const size_t bucket_bytes = PERFT_TABLE_BUCKET_SIZE * sizeof(PerftEntry);
+	const Bitboard fingerprint = perft_table_fingerprint();
+
+	size_t bucket_count = 1;
+	while (bucket_count * 2 * bucket_bytes <= megabytes * 1024 * 1024) bucket_count *= 2;
+
+	int fd = -1;
+	while (true)
+	{
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) return false;
+
+		// One process at a time looks at the header, a file replaced while waiting is opened again
+		struct stat locked, current;
+		if (flock(fd, LOCK_EX) != 0 || fstat(fd, &locked) != 0)
+		{
+			close(fd);
+			return false;
+		}
+		if (stat(path, &current) == 0 && current.st_ino == locked.st_ino && current.st_dev == locked.st_dev) break;
+		close(fd);
+	}
+
+	PerftFileHeader header;
+	struct stat info;
+	const bool valid = fstat(fd, &info) == 0 &&
+		lseek(fd, 0, SEEK_SET) == 0 && read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+		memcmp(header.magic, "CHSPERFT", 8) == 0 &&
+		header.version == PERFT_TABLE_VERSION &&
+		header.entry_size == sizeof(PerftEntry) &&
+		header.fingerprint == fingerprint &&
+		header.bucket_count != 0 && (header.bucket_count & (header.bucket_count - 1)) == 0 &&
+		(unsigned long long)info.st_size == PERFT_FILE_HEADER_SIZE + header.bucket_count * bucket_bytes;
+
+	if (valid)
+	{
+		// The file decides the size, so processes asking for different sizes still share it
+		bucket_count = header.bucket_count;
+	}
+	else
+	{
+		// Replaced instead of rewritten, processes that still map the old file keep a consistent table
+		char temporary[4096];
+		if (snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(temporary))
+		{
+			close(fd);
+			return false;
+		}
+
+		const int new_fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		bool created = new_fd >= 0;
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "CHSPERFT", 8);
+		header.version = PERFT_TABLE_VERSION;
+		header.entry_size = sizeof(PerftEntry);
+		header.bucket_count = bucket_count;
+		header.fingerprint = fingerprint;
+
+		created = created &&
+			ftruncate(new_fd, PERFT_FILE_HEADER_SIZE + bucket_count * bucket_bytes) == 0 &&
+			lseek(new_fd, 0, SEEK_SET) == 0 && write(new_fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+			rename(temporary, path) == 0;
+
+		if (!created)
+		{
+			if (new_fd >= 0) close(new_fd);
+			unlink(temporary);
+			close(fd);
+			return false;
+		}
+
+		// Waiting processes see the new inode and open the file again
+		close(fd);
+		fd = new_fd;
+	}
+
+	const size_t size = PERFT_FILE_HEADER_SIZE + bucket_count * bucket_bytes;
+	void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // also drops the lock, the mapping stays
+
+	if (mapping == MAP_FAILED) return false;
+
+	table->mapping = mapping;
+	table->mapping_size = size;
+	table->entries = (PerftEntry*)((char*)mapping + PERFT_FILE_HEADER_SIZE);
+	table->bucket_count = bucket_count;
+	table->probes = table->hits = table->stores = table->replacements = 0;
+	return true;
+#else
+	(void)table; (void)path; (void)megabytes;
+	return false;
+#endif // CHESS_MMAP_AVAILABLE
+}
+
+// The same position at another depth lands in another bucket
+static inline PerftEntry* perft_table_bucket(const PerftTable* table, const Bitboard key, const int depth)
+{
+	const Bitboard mixed = key ^ ((Bitboard)depth * 0x9E3779B97F4A7C15ULL);
+	return &table->entries[(mixed & (table->bucket_count - 1)) * PERFT_TABLE_BUCKET_SIZE];
+}
+
+// Entries may be written by another process at any time, both halves are read once and checked against each other
+static inline Bitboard perft_entry_load(const PerftEntry* entry, unsigned long long* data)
+{
+	*data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+	return __atomic_load_n(&entry->key, __ATOMIC_RELAXED) ^ *data;
+}
+
+static inline bool perft_table_probe(PerftTable* table, const Bitboard key, const int depth, unsigned long long* nodes)
+{
+	const PerftEntry* bucket = perft_table_bucket(table, key, depth);
+	table->probes++;
+
+	for (unsigned char i = 0; i < PERFT_TABLE_BUCKET_SIZE; i++)
+	{
+		unsigned long long data;
+		if (perft_entry_load(&bucket[i], &data) == key && data != 0 && PERFT_ENTRY_DEPTH(data) == depth)
+		{
+			table->hits++;
+			*nodes = PERFT_ENTRY_NODES(data);
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline void perft_table_store(PerftTable* table, const Bitboard key, const int depth, const unsigned long long nodes)
+{
+	PerftEntry* bucket = perft_table_bucket(table, key, depth);
+	PerftEntry* victim = &bucket[0];
+	Bitboard victim_key = 0;
+	unsigned long long victim_data = ~0ULL;
+
+	for (unsigned char i = 0; i < PERFT_TABLE_BUCKET_SIZE; i++)
+	{
+		unsigned long long data;
+		const Bitboard entry_key = perft_entry_load(&bucket[i], &data);
+
+		// Free slot (depth 0 is never stored) or the same entry
+		if (data == 0 || (entry_key == key && PERFT_ENTRY_DEPTH(data) == depth))
+		{
+			victim = &bucket[i];
+			victim_key = entry_key;
+			victim_data = data;
+			break;
+		}
+		if (PERFT_ENTRY_DEPTH(data) < PERFT_ENTRY_DEPTH(victim_data))
+		{
+			victim = &bucket[i];
+			victim_key = entry_key;
+			victim_data = data;
+		}
+	}
+
+	if (victim_data != 0 && victim_key != key)
+	{
+		if (PERFT_ENTRY_DEPTH(victim_data) > depth) return;
+		table->replacements++;
+	}
+
+	const unsigned long long data = ((unsigned long long)depth << 56) | nodes;
+	__atomic_store_n(&victim->key, key ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+	table->stores++;
+}
+
+static unsigned long long position_perft_hashed_node(Position* position, const int depth, const Player player, Castle castle, const Move last_move, const bool switch_player, PerftTable* table)
+{
+	if (depth == 0) return 1;
+
+	update_castle(position->board, &castle);
+	if (depth == 1) return position_count_moves(position, player, castle, last_move);
+
+	Bitboard key = 0;
+	unsigned long long total_moves = 0;
+	if (depth >= PERFT_TABLE_MIN_DEPTH)
+	{
+		key = position_hash(position, player, castle, last_move) ^ (switch_player ? 0 : PERFT_TABLE_NO_SWITCH);
+		if (perft_table_probe(table, key, depth, &total_moves)) return total_moves;
+	}
+
+	Move valid_moves[MAX_VALID_MOVES];
+	unsigned char move_count = 0;
+
+	position_generate_valid_moves(position, valid_moves, &move_count, player, castle, last_move);
+
+	for (int i = 0; i < move_count; i++)
+	{
+		const char capture_piece = position->board[GET_TO(valid_moves[i])];
+		position_make_move(position, valid_moves[i]);
+
+		total_moves += position_perft_hashed_node(position, depth - 1, switch_player ? SWITCH_PLAYER(player) : player, castle, valid_moves[i], switch_player, table);
+
+		position_undo_move(position, valid_moves[i], capture_piece);
+	}
+
+	if (depth >= PERFT_TABLE_MIN_DEPTH) perft_table_store(table, key, depth, total_moves);
+	return total_moves;
+}
+
+CHESSDEF unsigned long long position_perft_hashed(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, PerftTable* table)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (depth == 0) return 1;
+
+	if (player == BOTH)
+	{
+		return position_perft_hashed(position, depth, WHITE, castle, last_move, switch_player, table) +
+			   position_perft_hashed(position, depth, BLACK, castle, last_move, switch_player, table);
+	}
+
+	if (table == NULL || table->entries == NULL) return position_perft(position, depth, player, castle, last_move, switch_player);
+
+	return position_perft_hashed_node(position, depth, player, castle, last_move, switch_player, table);
+}
+
+/*
+ * Parallel perft: every line of `split_ply` moves from the root becomes a task, each worker owns a
+ * contiguous slice of them and takes from its front, idle workers steal single tasks from the back
+ * of the fullest slice. Workers replay a task's moves on their own copy of the position and run the
+ * serial position_perft below it, so counts are identical to position_perft.
+ */
+typedef struct
+{
+	Move path[PERFT_MAX_SPLIT_PLY];
+	unsigned char length;
+	Player player; // root player, BOTH is split into one set of tasks per player
+} PerftTask;
+
+typedef struct
+{
+	const Position* position;
+	int depth;
+	Castle castle;
+	Move last_move;
+	bool switch_player;
+	PerftTask* tasks;
+	unsigned int task_count;
+	unsigned int task_capacity;
+	unsigned int thread_count;
+	PerftThreadStats* stats;
+#ifdef CHESS_THREADS_AVAILABLE
+	struct
+	{
+		pthread_mutex_t lock;
+		unsigned int begin; // owner takes tasks from here
+		unsigned int end;   // thieves take tasks from here
+	} queues[PERFT_MAX_THREADS];
+#endif // CHESS_THREADS_AVAILABLE
+} PerftJob;
+
+typedef struct
+{
+	PerftJob* job;
+	unsigned int index;
+} PerftWorker;
+
+// Wall clock from standard C11, clock() would add up the CPU time of every thread
+static double perft_seconds(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Castle rights and last move travel down the path exactly like they do in position_perft
+static bool perft_add_tasks(PerftJob* job, Position* position, PerftTask* task, const unsigned int split_ply, const Player player, Castle castle, const Move last_move)
+{
+	if (task->length == split_ply)
+	{
+		if (job->task_count == job->task_capacity)
+		{
+			const unsigned int capacity = job->task_capacity ? job->task_capacity * 2 : 256;
+			PerftTask* tasks = realloc(job->tasks, capacity * sizeof(PerftTask));
+			if (tasks == NULL) return false;
+
+			job->tasks = tasks;
+			job->task_capacity = capacity;
+		}
+
+		job->tasks[job->task_count++] = *task;
+		return true;
+	}
+
+	Move valid_moves[MAX_VALID_MOVES];
+	unsigned char move_count = 0;
+	bool ok = true;
+
+	update_castle(position->board, &castle);
+	position_generate_valid_moves(position, valid_moves, &move_count, player, castle, last_move);
+
+	for (int i = 0; i < move_count && ok; i++)
+	{
+		const char captured_piece = position->board[GET_TO(valid_moves[i])];
+		position_make_move(position, valid_moves[i]);
+		task->path[task->length++] = valid_moves[i];
+
+		ok = perft_add_tasks(job, position, task, split_ply, job->switch_player ? SWITCH_PLAYER(player) : player, castle, valid_moves[i]);
+
+		task->length--;
+		position_undo_move(position, valid_moves[i], captured_piece);
+	}
+
+	return ok;
+}
+
+static unsigned long long perft_run_task(Position* position, const PerftJob* job, const PerftTask* task)
+{
+	char captured_pieces[PERFT_MAX_SPLIT_PLY];
+	Player player = task->player;
+	Castle castle = job->castle;
+	Move last_move = job->last_move;
+
+	for (unsigned char i = 0; i < task->length; i++)
+	{
+		update_castle(position->board, &castle);
+		captured_pieces[i] = position->board[GET_TO(task->path[i])];
+		position_make_move(position, task->path[i]);
+
+		last_move = task->path[i];
+		if (job->switch_player) player = SWITCH_PLAYER(player);
+	}
+
+	const unsigned long long nodes = position_perft(position, job->depth - task->length, player, castle, last_move, job->switch_player);
+
+	for (unsigned char i = task->length; i > 0; i--)
+	{
+		position_undo_move(position, task->path[i - 1], captured_pieces[i - 1]);
+	}
+
+	return nodes;
+}
+
+#ifdef CHESS_THREADS_AVAILABLE
+static PerftTask* perft_next_task(PerftJob* job, const unsigned int index)
+{
+	PerftTask* task = NULL;
+
+	pthread_mutex_lock(&job->queues[index].lock);
+	if (job->queues[index].begin < job->queues[index].end) task = &job->tasks[job->queues[index].begin++];
+	pthread_mutex_unlock(&job->queues[index].lock);
+
+	// Tasks are never added later, so all slices being empty means the work is done
+	while (task == NULL)
+	{
+		unsigned int victim = index, most = 0;
+		for (unsigned int i = 0; i < job->thread_count; i++)
+		{
+			pthread_mutex_lock(&job->queues[i].lock);
+			const unsigned int remaining = job->queues[i].end - job->queues[i].begin;
+			pthread_mutex_unlock(&job->queues[i].lock);
+
+			if (remaining > most)
+			{
+				most = remaining;
+				victim = i;
+			}
+		}
+		if (most == 0) return NULL;
+
+		pthread_mutex_lock(&job->queues[victim].lock);
+		if (job->queues[victim].begin < job->queues[victim].end) task = &job->tasks[--job->queues[victim].end];
+		pthread_mutex_unlock(&job->queues[victim].lock);
+
+		if (task != NULL) job->stats[index].steals++;
+	}
+
+	return task;
+}
+
+static void* perft_worker(void* argument)
+{
+	const PerftWorker* worker = argument;
+	PerftJob* job = worker->job;
+	PerftThreadStats* stats = &job->stats[worker->index];
+
+	// Every worker plays moves on its own copy
+	Position* position = malloc(sizeof(Position));
+	if (position == NULL) return NULL;
+	*position = *job->position;
+
+	const double start = perft_seconds();
+	for (const PerftTask* task; (task = perft_next_task(job, worker->index)) != NULL;)
+	{
+		stats->nodes += perft_run_task(position, job, task);
+		stats->tasks++;
+	}
+	stats->seconds = perft_seconds() - start;
+
+	free(position);
+	return NULL;
+}
+#endif // CHESS_THREADS_AVAILABLE
+
+CHESSDEF unsigned long long position_perft_parallel(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, unsigned int split_ply, PerftThreadStats* stats)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+#ifdef CHESS_THREADS_AVAILABLE
+	if (threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+#else
+	threads = 1;
+#endif // CHESS_THREADS_AVAILABLE
+
+	if (threads > PERFT_MAX_THREADS) threads = PERFT_MAX_THREADS;
+	if (split_ply == 0) split_ply = PERFT_DEFAULT_SPLIT_PLY;
+	if (split_ply > PERFT_MAX_SPLIT_PLY) split_ply = PERFT_MAX_SPLIT_PLY;
+	if (depth > 0 && split_ply >= (unsigned int)depth) split_ply = depth - 1;
+
+	PerftThreadStats local_stats[PERFT_MAX_THREADS];
+	if (stats == NULL) stats = local_stats;
+	memset(stats, 0, threads * sizeof(PerftThreadStats));
+
+	PerftJob* job = NULL;
+	bool split = false;
+
+#ifdef CHESS_THREADS_AVAILABLE
+	if (threads > 1 && depth > 1 && (job = calloc(1, sizeof(PerftJob))) != NULL)
+	{
+		PerftTask task = { .length = 0 };
+
+		job->position = position;
+		job->depth = depth;
+		job->castle = castle;
+		job->last_move = last_move;
+		job->switch_player = switch_player;
+		job->thread_count = threads;
+		job->stats = stats;
+
+		split = true;
+		for (unsigned char root = BLACK; root <= WHITE && split; root++)
+		{
+			if (player != BOTH && player != root) continue;
+
+			// position_perft sums WHITE first, keep that order so the tasks read like the serial recursion
+			task.player = player == BOTH ? (root == BLACK ? WHITE : BLACK) : (Player)root;
+			split = perft_add_tasks(job, position, &task, split_ply, task.player, castle, last_move);
+		}
+	}
+#endif // CHESS_THREADS_AVAILABLE
+
+	if (!split)
+	{
+		// Not worth splitting, or no threads: one worker does it all
+		const double start = perft_seconds();
+		stats[0].nodes = position_perft(position, depth, player, castle, last_move, switch_player);
+		stats[0].tasks = 1;
+		stats[0].seconds = perft_seconds() - start;
+		stats[0].nps = stats[0].seconds > 0 ? stats[0].nodes / stats[0].seconds : 0;
+
+		if (job != NULL) free(job->tasks);
+		free(job);
+		return stats[0].nodes;
+	}
+
+#ifdef CHESS_THREADS_AVAILABLE
+	PerftWorker workers[PERFT_MAX_THREADS];
+	pthread_t handles[PERFT_MAX_THREADS];
+	bool started[PERFT_MAX_THREADS] = { false };
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		pthread_mutex_init(&job->queues[i].lock, NULL);
+		job->queues[i].begin = (unsigned int)((unsigned long long)job->task_count * i / threads);
+		job->queues[i].end = (unsigned int)((unsigned long long)job->task_count * (i + 1) / threads);
+		workers[i] = (PerftWorker){ job, i };
+	}
+
+	// The calling thread is worker 0, tasks of a worker that failed to start are stolen by the others
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		started[i] = pthread_create(&handles[i], NULL, perft_worker, &workers[i]) == 0;
+	}
+	perft_worker(&workers[0]);
+
+	// Workers still running look at every queue while stealing, locks go away only after all joined
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		if (started[i]) pthread_join(handles[i], NULL);
+	}
+
+	unsigned long long total_nodes = 0;
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		pthread_mutex_destroy(&job->queues[i].lock);
+
+		stats[i].nps = stats[i].seconds > 0 ? stats[i].nodes / stats[i].seconds : 0;
+		total_nodes += stats[i].nodes;
+	}
+
+	free(job->tasks);
+	free(job);
+	return total_nodes;
+#else
+	UNREACHABLE;
+	return 0;
+#endif // CHESS_THREADS_AVAILABLE
+}
+
+/*
+ * Perft divide: the count below every root move, reported through a callback the moment it is known.
+ * Workers take the next root move from a shared index, so the slowest subtree starts as early as any.
+ */
+typedef struct
+{
+	const Position* position;
+	int depth;
+	Castle castle;
+	bool switch_player;
+	Move moves[2 * MAX_VALID_MOVES]; // BOTH puts the moves of both players at the root
+	Player players[2 * MAX_VALID_MOVES];
+	unsigned int count;
+	unsigned int next;
+	unsigned long long nodes;
+	PerftDivideCallback callback;
+	void* data;
+#ifdef CHESS_THREADS_AVAILABLE
+	pthread_mutex_t lock;
+#endif // CHESS_THREADS_AVAILABLE
+} PerftDivideJob;
+
+static unsigned long long perft_divide_move(Position* position, const PerftDivideJob* job, const unsigned int index, double* seconds)
+{
+	const Move move = job->moves[index];
+	const Player player = job->players[index];
+	const char captured_piece = position->board[GET_TO(move)];
+
+	const double start = perft_seconds();
+	position_make_move(position, move);
+	const unsigned long long nodes = position_perft(position, job->depth - 1, job->switch_player ? SWITCH_PLAYER(player) : player, job->castle, move, job->switch_player);
+	position_undo_move(position, move, captured_piece);
+
+	*seconds = perft_seconds() - start;
+	return nodes;
+}
+
+#ifdef CHESS_THREADS_AVAILABLE
+static void* perft_divide_worker(void* argument)
+{
+	PerftDivideJob* job = argument;
+
+	Position* position = malloc(sizeof(Position));
+	if (position == NULL) return NULL;
+	*position = *job->position;
+
+	while (true)
+	{
+		pthread_mutex_lock(&job->lock);
+		const unsigned int index = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (index >= job->count) break;
+
+		// Counted without the lock, reported under it so callbacks never overlap
+		double seconds;
+		const unsigned long long nodes = perft_divide_move(position, job, index, &seconds);
+
+		pthread_mutex_lock(&job->lock);
+		job->nodes += nodes;
+		if (job->callback != NULL) job->callback(job->moves[index], nodes, seconds, job->data);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	free(position);
+	return NULL;
+}
+#endif // CHESS_THREADS_AVAILABLE
+
+CHESSDEF unsigned long long position_perft_divide(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int threads, PerftDivideCallback callback, void* data)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	if (depth <= 0) return 1;
+
+	PerftDivideJob* job = calloc(1, sizeof(PerftDivideJob));
+	if (job == NULL) return 0;
+
+	job->position = position;
+	job->depth = depth;
+	job->castle = castle;
+	job->switch_player = switch_player;
+	job->callback = callback;
+	job->data = data;
+
+	update_castle(position->board, &job->castle);
+
+	// Same root order as position_perft, WHITE first for BOTH
+	for (unsigned char root = 0; root < 2; root++)
+	{
+		const Player mover = player == BOTH ? (root == 0 ? WHITE : BLACK) : player;
+		if (player != BOTH && root == 1) break;
+
+		unsigned char count = 0;
+		position_generate_valid_moves(position, job->moves + job->count, &count, mover, job->castle, last_move);
+		for (unsigned char i = 0; i < count; i++) job->players[job->count + i] = mover;
+		job->count += count;
+	}
+
+#ifdef CHESS_THREADS_AVAILABLE
+	if (threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+	if (threads > PERFT_MAX_THREADS) threads = PERFT_MAX_THREADS;
+	if (threads > job->count) threads = job->count;
+
+	if (threads > 1)
+	{
+		pthread_t handles[PERFT_MAX_THREADS];
+		bool started[PERFT_MAX_THREADS] = { false };
+
+		pthread_mutex_init(&job->lock, NULL);
+
+		// The calling thread works too, moves of a thread that failed to start go to the others
+		for (unsigned int i = 1; i < threads; i++)
+		{
+			started[i] = pthread_create(&handles[i], NULL, perft_divide_worker, job) == 0;
+		}
+		perft_divide_worker(job);
+
+		for (unsigned int i = 1; i < threads; i++)
+		{
+			if (started[i]) pthread_join(handles[i], NULL);
+		}
+		pthread_mutex_destroy(&job->lock);
+
+		const unsigned long long nodes = job->nodes;
+		free(job);
+		return nodes;
+	}
+#else
+	(void)threads;
+#endif // CHESS_THREADS_AVAILABLE
+
+	for (unsigned int i = 0; i < job->count; i++)
+	{
+		double seconds;
+		const unsigned long long nodes = perft_divide_move(position, job, i, &seconds);
+
+		job->nodes += nodes;
+		if (callback != NULL) callback(job->moves[i], nodes, seconds, data);
+	}
+
+	const unsigned long long nodes = job->nodes;
+	free(job);
+	return nodes;
+}
+
+/*
+ * Perft job with a journal: the root is split into the same tasks position_perft_parallel uses, every
+ * finished task is appended to a text file as "<task> <nodes>" and flushed. A rerun with the same
+ * position, depth and split reads the journal back and only counts the missing tasks, a line cut off by
+ * an interruption is ignored and simply counted again.
+ */
+#define PERFT_JOURNAL_MAGIC "chess-perft-journal 1"
+
+typedef struct
+{
+	PerftJob* job;
+	unsigned long long* nodes;  // [task]
+	bool* done;                 // [task]
+	unsigned int next;
+	FILE* journal;
+	bool failed;                // a journal write failed, the result is not trusted
+	PerftProgress progress;
+	PerftProgressCallback callback;
+	void* data;
+	double start;
+	unsigned int units_run;     // finished by this run, the ETA is based on them
+#ifdef CHESS_THREADS_AVAILABLE
+	pthread_mutex_t lock;
+#endif // CHESS_THREADS_AVAILABLE
+} PerftJournalJob;
+
+// Records a finished task, the caller holds the lock
+static void perft_journal_finish(PerftJournalJob* journal, const unsigned int task, const unsigned long long nodes)
+{
+	journal->nodes[task] = nodes;
+	journal->done[task] = true;
+
+	if (fprintf(journal->journal, "%u %llu\n", task, nodes) < 0 || fflush(journal->journal) != 0) journal->failed = true;
+
+	PerftProgress* progress = &journal->progress;
+	progress->units_done++;
+	progress->nodes += nodes;
+	progress->seconds = perft_seconds() - journal->start;
+
+	journal->units_run++;
+	progress->eta = progress->seconds / journal->units_run * (progress->unit_count - progress->units_done);
+
+	if (journal->callback != NULL) journal->callback(progress, journal->data);
+}
+
+// Next task that is not in the journal yet, the caller holds the lock
+static bool perft_journal_next(PerftJournalJob* journal, unsigned int* task)
+{
+	while (journal->next < journal->job->task_count && journal->done[journal->next]) journal->next++;
+	if (journal->next == journal->job->task_count) return false;
+
+	*task = journal->next++;
+	return true;
+}
+
+#ifdef CHESS_THREADS_AVAILABLE
+static void* perft_journal_worker(void* argument)
+{
+	PerftJournalJob* journal = argument;
+
+	Position* position = malloc(sizeof(Position));
+	if (position == NULL) return NULL;
+	*position = *journal->job->position;
+
+	while (true)
+	{
+		unsigned int task;
+
+		pthread_mutex_lock(&journal->lock);
+		const bool found = perft_journal_next(journal, &task);
+		pthread_mutex_unlock(&journal->lock);
+
+		if (!found) break;
+
+		const unsigned long long nodes = perft_run_task(position, journal->job, &journal->job->tasks[task]);
+
+		pthread_mutex_lock(&journal->lock);
+		perft_journal_finish(journal, task, nodes);
+		pthread_mutex_unlock(&journal->lock);
+	}
+
+	free(position);
+	return NULL;
+}
+#endif // CHESS_THREADS_AVAILABLE
+
+// Reads the finished tasks back, false when the journal belongs to another job
+static bool perft_journal_load(PerftJournalJob* journal, FILE* file, const char* header)
+{
+	char line[256];
+
+	// A new or empty journal gets the header, streams need a seek between reading and writing
+	if (fgets(line, sizeof(line), file) == NULL) return fseek(file, 0, SEEK_END) == 0 && fputs(header, file) >= 0 && fflush(file) == 0;
+	if (strcmp(line, header) != 0) return false;
+
+	bool complete = true;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		unsigned int task;
+		unsigned long long nodes;
+		char end;
+
+		complete = line[strlen(line) - 1] == '\n';
+
+		// Only complete lines count, the last one may have been cut off
+		if (sscanf(line, "%u %llu%c", &task, &nodes, &end) != 3 || end != '\n' || task >= journal->job->task_count) continue;
+		if (journal->done[task]) continue;
+
+		journal->done[task] = true;
+		journal->nodes[task] = nodes;
+		journal->progress.units_done++;
+		journal->progress.units_resumed++;
+		journal->progress.nodes += nodes;
+	}
+
+	// New records must not continue a line that was cut off
+	return fseek(file, 0, SEEK_END) == 0 && (complete || fputc('\n', file) != EOF);
+}
+
+CHESSDEF bool position_perft_journal(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, const char* path, unsigned int threads, unsigned int split_ply, PerftProgressCallback progress, void* data, unsigned long long* nodes)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	*nodes = 0;
+	if (depth <= 1)
+	{
+		*nodes = position_perft(position, depth, player, castle, last_move, switch_player);
+		return true;
+	}
+
+#ifdef CHESS_THREADS_AVAILABLE
+	if (threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+#else
+	threads = 1;
+#endif // CHESS_THREADS_AVAILABLE
+	if (threads > PERFT_MAX_THREADS) threads = PERFT_MAX_THREADS;
+
+	if (split_ply == 0) split_ply = PERFT_DEFAULT_SPLIT_PLY;
+	if (split_ply > PERFT_MAX_SPLIT_PLY) split_ply = PERFT_MAX_SPLIT_PLY;
+	if (split_ply >= (unsigned int)depth) split_ply = depth - 1;
+
+	PerftJournalJob journal = { .callback = progress, .data = data };
+	journal.job = calloc(1, sizeof(PerftJob));
+	if (journal.job == NULL) return false;
+
+	PerftJob* job = journal.job;
+	job->position = position;
+	job->depth = depth;
+	job->castle = castle;
+	job->last_move = last_move;
+	job->switch_player = switch_player;
+
+	// Same tasks in the same order on every run, their index identifies them in the journal
+	bool ok = true;
+	for (unsigned char root = BLACK; root <= WHITE && ok; root++)
+	{
+		if (player != BOTH && player != root) continue;
+
+		PerftTask task = { .length = 0 };
+		task.player = player == BOTH ? (root == BLACK ? WHITE : BLACK) : (Player)root;
+		ok = perft_add_tasks(job, position, &task, split_ply, task.player, castle, last_move);
+	}
+
+	journal.nodes = calloc(job->task_count ? job->task_count : 1, sizeof(unsigned long long));
+	journal.done = calloc(job->task_count ? job->task_count : 1, sizeof(bool));
+
+	// The header pins the job, a journal of another position or split is never mixed in
+	char header[256];
+	snprintf(header, sizeof(header), PERFT_JOURNAL_MAGIC " key %016llx depth %d player %d castle %u last %u switch %d split %u tasks %u\n",
+	         (unsigned long long)position_hash(position, player == BLACK ? BLACK : WHITE, castle, last_move),
+	         depth, (int)player, (unsigned int)castle, (unsigned int)last_move, (int)switch_player, split_ply, job->task_count);
+
+	FILE* file = ok && journal.nodes && journal.done ? fopen(path, "a+") : NULL;
+	if (file != NULL) rewind(file);
+
+	ok = file != NULL && perft_journal_load(&journal, file, header);
+	journal.journal = file;
+	journal.progress.unit_count = job->task_count;
+	journal.progress.eta = -1;
+	journal.start = perft_seconds();
+
+	if (ok)
+	{
+#ifdef CHESS_THREADS_AVAILABLE
+		if (threads > 1)
+		{
+			pthread_t handles[PERFT_MAX_THREADS];
+			bool started[PERFT_MAX_THREADS] = { false };
+
+			pthread_mutex_init(&journal.lock, NULL);
+			for (unsigned int i = 1; i < threads; i++)
+			{
+				started[i] = pthread_create(&handles[i], NULL, perft_journal_worker, &journal) == 0;
+			}
+			perft_journal_worker(&journal);
+
+			for (unsigned int i = 1; i < threads; i++)
+			{
+				if (started[i]) pthread_join(handles[i], NULL);
+			}
+			pthread_mutex_destroy(&journal.lock);
+		}
+		else
+#endif // CHESS_THREADS_AVAILABLE
+		{
+			for (unsigned int task; perft_journal_next(&journal, &task);)
+			{
+				perft_journal_finish(&journal, task, perft_run_task(position, job, &job->tasks[task]));
+			}
+		}
+
+		// Every task has to be counted, a worker that could not allocate its position leaves some behind
+		for (unsigned int i = 0; i < job->task_count; i++)
+		{
+			if (!journal.done[i]) ok = false;
+			*nodes += journal.nodes[i];
+		}
+		ok = ok && !journal.failed;
+	}
+
+	if (file != NULL) fclose(file);
+	free(journal.nodes);
+	free(journal.done);
+	free(job->tasks);
+	free(job);
+	return ok;
+}
+
+/*
+ * Breadth-first perft: the tree is expanded one ply at a time up to the frontier and every ply is kept as a
+ * set of distinct positions with the number of move sequences that reach them, so transpositions are merged
+ * and the rest of the depth is counted once per distinct frontier position.
+ * The ply being read and the ply being built get half of the memory budget each. A ply that outgrows its table
+ * is spilled to PERFT_FRONTIER_PARTITIONS temporary files by hash and merged back one partition at a time.
+ * A partition that still does not fit is handed on in pieces, which repeats some work but keeps the count exact.
+ */
+#define PERFT_FRONTIER_PARTITION_BITS 6
+#define PERFT_FRONTIER_PARTITIONS (1 << PERFT_FRONTIER_PARTITION_BITS)
+#define PERFT_FRONTIER_PARTITION(hash) ((unsigned int)((hash) >> (64 - PERFT_FRONTIER_PARTITION_BITS)))
+#define PERFT_FRONTIER_CHUNK 256 // table slots a counting worker takes at a time
+
+typedef struct
+{
+	Bitboard hash;             // position_hash, the low bits pick the slot and the high bits the partition
+	unsigned long long count;  // move sequences reaching the position, 0 marks a free slot
+	unsigned char squares[32]; // two squares per byte, see perft_frontier_pack
+	Castle castle;             // rights update_castle left
+	unsigned char player;      // side to move
+	Move last_move;            // NO_MOVE unless it allows an en passant capture
+} PerftFrontierEntry;
+
+typedef struct
+{
+	PerftFrontierEntry* entries;
+	size_t capacity;           // power of two
+	size_t size;
+	size_t limit;              // a fuller table is spilled
+	FILE* files[PERFT_FRONTIER_PARTITIONS]; // opened by the first spill that needs them
+	bool spilled;
+	unsigned long long written;
+} PerftFrontierLevel;
+
+typedef struct
+{
+	Position* position;        // expansion scratch
+	PerftFrontierLevel* next;  // ply being built
+	PerftFrontierLevel* level; // table being counted
+	int depth;                 // left below the frontier
+	bool switch_player;
+	unsigned int threads;
+	size_t index;              // next slot of the counted table
+	unsigned long long nodes;
+	unsigned long long paths;
+	unsigned long long positions;
+} PerftFrontierJob;
+
+// Only what the generators look at is kept, positions that play the same are packed the same
+static void perft_frontier_pack(const Position* position, const Player player, Castle castle, Move last_move, PerftFrontierEntry* entry)
+{
+	update_castle(position->board, &castle);
+	castle &= INITIAL_CASTLE;
+	if (!can_en_passant(position->board, player, last_move)) last_move = NO_MOVE;
+
+	for (Square square = 0; square < 64; square += 2)
+	{
+		unsigned char codes[2] = { 0, 0 };
+		for (unsigned char i = 0; i < 2; i++)
+		{
+			const char piece = position->board[square + i];
+			if (piece != ' ') codes[i] = (unsigned char)(PIECE_TYPE(piece) + 1) | (PIECE_PLAYER(piece) == BLACK ? 8 : 0);
+		}
+		entry->squares[square / 2] = codes[0] | (unsigned char)(codes[1] << 4);
+	}
+
+	entry->hash = position_hash(position, player, castle, last_move);
+	entry->castle = castle;
+	entry->player = (unsigned char)player;
+	entry->last_move = last_move;
+}
+
+static void perft_frontier_unpack(Position* position, const PerftFrontierEntry* entry)
+{
+	char board[64];
+
+	for (Square square = 0; square < 64; square++)
+	{
+		const unsigned char code = (entry->squares[square / 2] >> (square & 1 ? 4 : 0)) & 0x0F;
+		board[square] = code ? PIECE_CHAR(code & 8 ? BLACK : WHITE, (code & 7) - 1) : ' ';
+	}
+
+	position_init(position, board);
+}
+
+static bool perft_frontier_level_init(PerftFrontierLevel* level, const size_t capacity)
+{
+	memset(level, 0, sizeof(PerftFrontierLevel));
+	level->entries = calloc(capacity, sizeof(PerftFrontierEntry));
+	level->capacity = capacity;
+	level->limit = capacity / 4 * 3;
+	return level->entries != NULL;
+}
+
+static void perft_frontier_level_free(PerftFrontierLevel* level)
+{
+	for (unsigned int i = 0; i < PERFT_FRONTIER_PARTITIONS; i++)
+	{
+		if (level->files[i] != NULL) fclose(level->files[i]);
+		level->files[i] = NULL;
+	}
+
+	free(level->entries);
+	level->entries = NULL;
+}
+
+static void perft_frontier_reset(PerftFrontierLevel* level)
+{
+	if (level->size == 0) return;
+
+	memset(level->entries, 0, level->capacity * sizeof(PerftFrontierEntry));
+	level->size = 0;
+}
+
+// Adds the paths of `entry` to its slot, the caller makes sure a free slot is left
+static void perft_frontier_merge(PerftFrontierLevel* level, const PerftFrontierEntry* entry)
+{
+	for (size_t slot = entry->hash & (level->capacity - 1);; slot = (slot + 1) & (level->capacity - 1))
+	{
+		PerftFrontierEntry* current = &level->entries[slot];
+
+		if (current->count == 0)
+		{
+			*current = *entry;
+			level->size++;
+			return;
+		}
+
+		// The key only finds the slot, the position decides, so a hash collision can not merge two positions
+		if (current->hash == entry->hash && current->castle == entry->castle && current->player == entry->player &&
+			current->last_move == entry->last_move && memcmp(current->squares, entry->squares, sizeof(entry->squares)) == 0)
+		{
+			current->count += entry->count;
+			return;
+		}
+	}
+}
+
+// Moves the whole table to the partition files, the table is empty afterwards
+static bool perft_frontier_spill(PerftFrontierLevel* level)
+{
+	bool ok = true;
+
+	for (size_t i = 0; i < level->capacity && ok; i++)
+	{
+		const PerftFrontierEntry* entry = &level->entries[i];
+		if (entry->count == 0) continue;
+
+		FILE** file = &level->files[PERFT_FRONTIER_PARTITION(entry->hash)];
+		if (*file == NULL) *file = tmpfile();
+
+		ok = *file != NULL && fwrite(entry, sizeof(PerftFrontierEntry), 1, *file) == 1;
+		level->written++;
+	}
+
+	perft_frontier_reset(level);
+	level->spilled = true;
+	return ok;
+}
+
+static bool perft_frontier_add(PerftFrontierLevel* level, const PerftFrontierEntry* entry)
+{
+	if (level->size >= level->limit && !perft_frontier_spill(level)) return false;
+
+	perft_frontier_merge(level, entry);
+	return true;
+}
+
+// Hands the ply to `process` one table at a time, the ply is empty afterwards
+static bool perft_frontier_drain(PerftFrontierLevel* level, PerftFrontierJob* job, bool (*process)(PerftFrontierLevel*, PerftFrontierJob*))
+{
+	if (!level->spilled)
+	{
+		const bool ok = process(level, job);
+		perft_frontier_reset(level);
+		return ok;
+	}
+
+	// What is still in memory joins the partitions, so it is merged with the spilled copies of its positions
+	bool ok = perft_frontier_spill(level);
+
+	PerftFrontierEntry buffer[256];
+	for (unsigned int partition = 0; partition < PERFT_FRONTIER_PARTITIONS; partition++)
+	{
+		FILE* file = level->files[partition];
+		if (file == NULL) continue;
+
+		ok = ok && fseek(file, 0, SEEK_SET) == 0;
+		for (size_t read; ok && (read = fread(buffer, sizeof(PerftFrontierEntry), 256, file)) > 0;)
+		{
+			for (size_t i = 0; i < read && ok; i++)
+			{
+				if (level->size >= level->limit)
+				{
+					ok = process(level, job);
+					perft_frontier_reset(level);
+				}
+				perft_frontier_merge(level, &buffer[i]);
+			}
+		}
+
+		ok = ok && !ferror(file) && process(level, job);
+		perft_frontier_reset(level);
+
+		fclose(file);
+		level->files[partition] = NULL;
+	}
+
+	level->spilled = false;
+	return ok;
+}
+
+// Builds the next ply from every position of the table
+static bool perft_frontier_expand(PerftFrontierLevel* level, PerftFrontierJob* job)
+{
+	Position* position = job->position;
+
+	for (size_t i = 0; i < level->capacity; i++)
+	{
+		const PerftFrontierEntry* entry = &level->entries[i];
+		if (entry->count == 0) continue;
+
+		Move valid_moves[MAX_VALID_MOVES];
+		unsigned char move_count = 0;
+		const Player player = (Player)entry->player;
+		const Player next_player = job->switch_player ? SWITCH_PLAYER(player) : player;
+
+		perft_frontier_unpack(position, entry);
+		position_generate_valid_moves(position, valid_moves, &move_count, player, entry->castle, entry->last_move);
+
+		for (int m = 0; m < move_count; m++)
+		{
+			PerftFrontierEntry child;
+			const char captured_piece = position->board[GET_TO(valid_moves[m])];
+
+			position_make_move(position, valid_moves[m]);
+			perft_frontier_pack(position, next_player, entry->castle, valid_moves[m], &child);
+			position_undo_move(position, valid_moves[m], captured_piece);
+
+			child.count = entry->count;
+			if (!perft_frontier_add(job->next, &child)) return false;
+		}
+	}
+
+	return true;
+}
+
+// Counts the table from the slots it takes, several workers share a table
+static void* perft_frontier_worker(void* argument)
+{
+	PerftFrontierJob* job = argument;
+	const PerftFrontierLevel* level = job->level;
+
+	Position* position = malloc(sizeof(Position));
+	if (position == NULL) return NULL;
+
+	unsigned long long nodes = 0, paths = 0, positions = 0;
+	for (size_t begin; (begin = __atomic_fetch_add(&job->index, PERFT_FRONTIER_CHUNK, __ATOMIC_RELAXED)) < level->capacity;)
+	{
+		const size_t end = begin + PERFT_FRONTIER_CHUNK < level->capacity ? begin + PERFT_FRONTIER_CHUNK : level->capacity;
+
+		for (size_t i = begin; i < end; i++)
+		{
+			const PerftFrontierEntry* entry = &level->entries[i];
+			if (entry->count == 0) continue;
+
+			perft_frontier_unpack(position, entry);
+			nodes += entry->count * position_perft(position, job->depth, (Player)entry->player, entry->castle, entry->last_move, job->switch_player);
+			paths += entry->count;
+			positions++;
+		}
+	}
+
+	__atomic_fetch_add(&job->nodes, nodes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&job->paths, paths, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&job->positions, positions, __ATOMIC_RELAXED);
+
+	free(position);
+	return NULL;
+}
+
+static bool perft_frontier_count(PerftFrontierLevel* level, PerftFrontierJob* job)
+{
+	job->level = level;
+	job->index = 0;
+
+#ifdef CHESS_THREADS_AVAILABLE
+	pthread_t handles[PERFT_MAX_THREADS];
+	bool started[PERFT_MAX_THREADS] = { false };
+
+	// Small tables are not worth the threads
+	const unsigned int threads = level->size >= (size_t)job->threads * PERFT_FRONTIER_CHUNK / 4 ? job->threads : 1;
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		started[i] = pthread_create(&handles[i], NULL, perft_frontier_worker, job) == 0;
+	}
+	perft_frontier_worker(job);
+
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		if (started[i]) pthread_join(handles[i], NULL);
+	}
+#else
+	perft_frontier_worker(job);
+#endif // CHESS_THREADS_AVAILABLE
+
+	// Every slot has to be taken, workers that could not allocate their position take none
+	return job->index >= level->capacity;
+}
+
+CHESSDEF bool position_perft_frontier(Position* position, const int depth, const Player player, const Castle castle, const Move last_move, const bool switch_player, unsigned int frontier_ply, unsigned int threads, const size_t megabytes, PerftFrontierStats* stats, unsigned long long* nodes)
+{
+#ifdef USE_PLAYER_CHECK
+	if (!CHECK_VALID_PLAYER(player)) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	PerftFrontierStats local_stats;
+	if (stats == NULL) stats = &local_stats;
+	memset(stats, 0, sizeof(PerftFrontierStats));
+
+	*nodes = 0;
+	if (depth <= 1)
+	{
+		*nodes = position_perft(position, depth, player, castle, last_move, switch_player);
+		return true;
+	}
+
+#ifdef CHESS_THREADS_AVAILABLE
+	if (threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+#else
+	threads = 1;
+#endif // CHESS_THREADS_AVAILABLE
+	if (threads > PERFT_MAX_THREADS) threads = PERFT_MAX_THREADS;
+
+	if (frontier_ply == 0) frontier_ply = PERFT_FRONTIER_DEFAULT_PLY;
+	if (frontier_ply >= (unsigned int)depth) frontier_ply = depth - 1;
+
+	// Two tables share the budget
+	size_t capacity = 1024;
+	while (capacity * 2 * 2 * sizeof(PerftFrontierEntry) <= megabytes * 1024 * 1024) capacity *= 2;
+
+	PerftFrontierLevel levels[2];
+	PerftFrontierJob job = { .switch_player = switch_player, .threads = threads };
+
+	bool ok = perft_frontier_level_init(&levels[0], capacity);
+	ok = perft_frontier_level_init(&levels[1], capacity) && ok;
+	job.position = ok ? malloc(sizeof(Position)) : NULL;
+	ok = ok && job.position != NULL;
+
+	// The root is the first ply, once per side for BOTH
+	for (unsigned char root = BLACK; root <= WHITE && ok; root++)
+	{
+		if (player != BOTH && player != root) continue;
+
+		PerftFrontierEntry entry;
+		perft_frontier_pack(position, (Player)root, castle, last_move, &entry);
+		entry.count = 1;
+		ok = perft_frontier_add(&levels[0], &entry);
+	}
+
+	PerftFrontierLevel* current = &levels[0];
+	for (unsigned int ply = 0; ply < frontier_ply && ok; ply++)
+	{
+		job.next = current == &levels[0] ? &levels[1] : &levels[0];
+		ok = perft_frontier_drain(current, &job, perft_frontier_expand);
+		current = job.next;
+	}
+
+	job.depth = depth - (int)frontier_ply;
+	ok = ok && perft_frontier_drain(current, &job, perft_frontier_count);
+
+	stats->frontier_ply = frontier_ply;
+	stats->paths = job.paths;
+	stats->positions = job.positions;
+	stats->spilled = levels[0].written + levels[1].written;
+	*nodes = job.nodes;
+
+	free(job.position);
+	perft_frontier_level_free(&levels[0]);
+	perft_frontier_level_free(&levels[1]);
+	return ok;
+}
+
+CHESSDEF Bitboard position_hash(const Position* position, const Player player, const Castle castle, const Move last_move)
+{
+#ifdef USE_PLAYER_CHECK
+	if (player != WHITE && player != BLACK) { UNREACHABLE; }
+#endif // USE_PLAYER_CHECK
+
+	Bitboard key = position->key ^ ZOBRIST_CASTLE[castle & INITIAL_CASTLE];
+
+	if (player == BLACK) key ^= ZOBRIST_BLACK_TO_MOVE;
+
+	// Positions that only differ by an en passant nobody can take are the same position
+	if (can_en_passant(position->board, player, last_move)) key ^= ZOBRIST_EN_PASSANT[GET_COL(GET_TO(last_move))];
+
+	return key;
+}
+
+
+/*
+ * Evaluation: material and piece-square tables, the king moves from its middlegame table to its endgame table
+ * as the pieces come off. Tables are seen from white with a8 first like the board, black mirrors the rows.
+ */
+static const short PIECE_VALUES[6] = { 100, 320, 330, 500, 900, 0 };
+static const unsigned char PIECE_PHASES[6] = { 0, 1, 1, 2, 4, 0 }; // 24 with every piece on the board
+
+static const signed char PIECE_SQUARE_TABLES[7][64] = {
+	{ // pawn
+		 0,  0,  0,  0,  0,  0,  0,  0,
+		50, 50, 50, 50, 50, 50, 50, 50,
+		10, 10, 20, 30, 30, 20, 10, 10,
+		 5,  5, 10, 25, 25, 10,  5,  5,
+		 0,  0,  0, 20, 20,  0,  0,  0,
+		 5, -5,-10,  0,  0,-10, -5,  5,
+		 5, 10, 10,-20,-20, 10, 10,  5,
+		 0,  0,  0,  0,  0,  0,  0,  0,
+	},
+	{ // knight
+		-50,-40,-30,-30,-30,-30,-40,-50,
+		-40,-20,  0,  0,  0,  0,-20,-40,
+		-30,  0, 10, 15, 15, 10,  0,-30,
+		-30,  5, 15, 20, 20, 15,  5,-30,
+		-30,  0, 15, 20, 20, 15,  0,-30,
+		-30,  5, 10, 15, 15, 10,  5,-30,
+		-40,-20,  0,  5,  5,  0,-20,-40,
+		-50,-40,-30,-30,-30,-30,-40,-50,
+	},
+	{ // bishop
+		-20,-10,-10,-10,-10,-10,-10,-20,
+		-10,  0,  0,  0,  0,  0,  0,-10,
+		-10,  0,  5, 10, 10,  5,  0,-10,
+		-10,  5,  5, 10, 10,  5,  5,-10,
+		-10,  0, 10, 10, 10, 10,  0,-10,
+		-10, 10, 10, 10, 10, 10, 10,-10,
+		-10,  5,  0,  0,  0,  0,  5,-10,
+		-20,-10,-10,-10,-10,-10,-10,-20,
+	},
+	{ // rook
+		 0,  0,  0,  0,  0,  0,  0,  0,
+		 5, 10, 10, 10, 10, 10, 10,  5,
+		-5,  0,  0,  0,  0,  0,  0, -5,
+		-5,  0,  0,  0,  0,  0,  0, -5,
+		-5,  0,  0,  0,  0,  0,  0, -5,
+		-5,  0,  0,  0,  0,  0,  0, -5,
+		-5,  0,  0,  0,  0,  0,  0, -5,
+		 0,  0,  0,  5,  5,  0,  0,  0,
+	},
+	{ // queen
+		-20,-10,-10, -5, -5,-10,-10,-20,
+		-10,  0,  0,  0,  0,  0,  0,-10,
+		-10,  0,  5,  5,  5,  5,  0,-10,
+		 -5,  0,  5,  5,  5,  5,  0, -5,
+		  0,  0,  5,  5,  5,  5,  0, -5,
+		-10,  5,  5,  5,  5,  5,  0,-10,
+		-10,  0,  5,  0,  0,  0,  0,-10,
+		-20,-10,-10, -5, -5,-10,-10,-20,
+	},
+	{ // king, middlegame
+		-30,-40,-40,-50,-50,-40,-40,-30,
+		-30,-40,-40,-50,-50,-40,-40,-30,
+		-30,-40,-40,-50,-50,-40,-40,-30,
+		-30,-40,-40,-50,-50,-40,-40,-30,
+		-20,-30,-30,-40,-40,-30,-30,-20,
+		-10,-20,-20,-20,-20,-20,-20,-10,
+		 20, 20,  0,  0,  0,  0, 20, 20,
+		 20, 30, 10,  0,  0, 10, 30, 20,
+	},
+	{ // king, endgame
+		-50,-40,-30,-20,-20,-30,-40,-50,
+		-30,-20,-10,  0,  0,-10,-20,-30,
+		-30,-10, 20, 30, 30, 20,-10,-30,
+		-30,-10, 30, 40, 40, 30,-10,-30,
+		-30,-10, 30, 40, 40, 30,-10,-30,
+		-30,-10, 20, 30, 30, 20,-10,-30,
+		-30,-30,  0,  0,  0,  0,-30,-30,
+		-50,-30,-30,-30,-30,-30,-30,-50,
+	},
+};
+
+CHESSDEF int position_evaluate(const Position* position)
+{
+	int score = 0, king_middlegame = 0, king_endgame = 0, phase = 0;
+
+	for (unsigned char player = BLACK; player <= WHITE; player++)
+	{
+		const int sign = player == WHITE ? 1 : -1;
+		const Square mirror = player == WHITE ? 0 : 56;
+
+		for (unsigned char type = PIECE_PAWN; type < PIECE_KING; type++)
+		{
+			for (Bitboard pieces = position->pieces[player][type]; pieces; POP_LSB(pieces))
+			{
+				score += sign * (PIECE_VALUES[type] + PIECE_SQUARE_TABLES[type][LSB(pieces) ^ mirror]);
+				phase += PIECE_PHASES[type];
+			}
+		}
+
+		if (position->king_square[player] != NO_SQUARE)
+		{
+			king_middlegame += sign * PIECE_SQUARE_TABLES[PIECE_KING][position->king_square[player] ^ mirror];
+			king_endgame += sign * PIECE_SQUARE_TABLES[PIECE_KING + 1][position->king_square[player] ^ mirror];
+		}
+	}
+
+	if (phase > 24) phase = 24; // promotions
+	score += (king_middlegame * phase + king_endgame * (24 - phase)) / 24;
+
+	return position->player == WHITE ? score : -score;
+}
+
+#define SEARCH_ENTRY_MOVE(data) ((Move)((data) & 0xFFFF))
+#define SEARCH_ENTRY_SCORE(data) ((int)(short)(((data) >> 16) & 0xFFFF))
+#define SEARCH_ENTRY_DEPTH(data) ((int)(((data) >> 32) & 0xFF))
+#define SEARCH_ENTRY_BOUND(data) ((int)(((data) >> 40) & 0x3))
+#define SEARCH_ENTRY_AGE(data) ((unsigned char)((data) >> 48))
+
+// Stored entries always have a bound, so data 0 is a free slot
+enum { SEARCH_BOUND_UPPER = 1, SEARCH_BOUND_LOWER = 2, SEARCH_BOUND_EXACT = 3 };
+
+CHESSDEF bool search_table_init(SearchTable* table, const size_t megabytes)
+{
+	const size_t bucket_bytes = SEARCH_TABLE_BUCKET_SIZE * sizeof(SearchEntry);
+
+	// Largest power of two number of buckets that fits
+	size_t bucket_count = 1;
+	while (bucket_count * 2 * bucket_bytes <= megabytes * 1024 * 1024) bucket_count *= 2;
+
+	table->entries = aligned_alloc(64, bucket_count * bucket_bytes);
+	table->bucket_count = table->entries ? bucket_count : 0;
+	search_table_clear(table);
+
+	return table->entries != NULL;
+}
+
+CHESSDEF bool search_table_resize(SearchTable* table, const size_t megabytes)
+{
+	SearchTable resized;
+	if (!search_table_init(&resized, megabytes)) return false;
+
+	search_table_free(table);
+	*table = resized;
+	return true;
+}
+
+CHESSDEF void search_table_clear(SearchTable* table)
+{
+	if (table->entries) memset(table->entries, 0, table->bucket_count * SEARCH_TABLE_BUCKET_SIZE * sizeof(SearchEntry));
+	table->age = 0;
+}
+
+CHESSDEF void search_table_free(SearchTable* table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->bucket_count = 0;
+}
+
+CHESSDEF int search_table_hashfull(const SearchTable* table)
+{
+	const size_t sample = table->bucket_count * SEARCH_TABLE_BUCKET_SIZE < 1000 ? table->bucket_count * SEARCH_TABLE_BUCKET_SIZE : 1000;
+	size_t used = 0;
+
+	for (size_t i = 0; i < sample; i++)
+	{
+		const unsigned long long data = __atomic_load_n(&table->entries[i].data, __ATOMIC_RELAXED);
+		if (data != 0 && SEARCH_ENTRY_AGE(data) == table->age) used++;
+	}
+
+	return sample ? (int)(used * 1000 / sample) : 0;
+}
+
+// Mate scores are stored as the distance from the entry's position, not from the root
+static inline int search_score_to_table(const int score, const int ply)
+{
+	return score >= SEARCH_MATE - SEARCH_MAX_PLY ? score + ply : score <= -(SEARCH_MATE - SEARCH_MAX_PLY) ? score - ply : score;
+}
+
+static inline int search_score_from_table(const int score, const int ply)
+{
+	return score >= SEARCH_MATE - SEARCH_MAX_PLY ? score - ply : score <= -(SEARCH_MATE - SEARCH_MAX_PLY) ? score + ply : score;
+}
+
+static inline bool search_table_probe(const SearchTable* table, const Bitboard key, unsigned long long* data)
+{
+	const SearchEntry* bucket = &table->entries[(key & (table->bucket_count - 1)) * SEARCH_TABLE_BUCKET_SIZE];
+
+	for (unsigned char i = 0; i < SEARCH_TABLE_BUCKET_SIZE; i++)
+	{
+		*data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+		if (*data != 0 && (__atomic_load_n(&bucket[i].key, __ATOMIC_RELAXED) ^ *data) == key) return true;
+	}
+	return false;
+}
+
+static inline void search_table_store(SearchTable* table, const Bitboard key, Move move, const int score, const int depth, const int bound)
+{
+	SearchEntry* bucket = &table->entries[(key & (table->bucket_count - 1)) * SEARCH_TABLE_BUCKET_SIZE];
+	SearchEntry* victim = &bucket[0];
+	int victim_value = SEARCH_INFINITE;
+
+	for (unsigned char i = 0; i < SEARCH_TABLE_BUCKET_SIZE; i++)
+	{
+		const unsigned long long data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+
+		// A fail low has no best move, the one found earlier for the position is still the best guess
+		if (data != 0 && (__atomic_load_n(&bucket[i].key, __ATOMIC_RELAXED) ^ data) == key)
+		{
+			if (move == NO_MOVE) move = SEARCH_ENTRY_MOVE(data);
+			victim = &bucket[i];
+			break;
+		}
+
+		// Free slots first, then old searches, then shallow entries
+		const int value = data == 0 ? -SEARCH_INFINITE : SEARCH_ENTRY_DEPTH(data) - 8 * (unsigned char)(table->age - SEARCH_ENTRY_AGE(data));
+		if (value < victim_value)
+		{
+			victim = &bucket[i];
+			victim_value = value;
+		}
+	}
+
+	const unsigned long long data = (unsigned long long)move | ((unsigned long long)(unsigned short)score << 16) |
+		((unsigned long long)depth << 32) | ((unsigned long long)bound << 40) | ((unsigned long long)table->age << 48);
+	__atomic_store_n(&victim->key, key ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+}
+
+/*
+ * Search: iterative deepening negamax with alpha-beta and principal variation search. Every iteration tries
+ * the previous principal variation first, elsewhere the move of the transposition table goes first, then the
+ * staged MoveGenerator orders captures and killers. Table scores only cut off outside the principal variation.
+ * At the horizon a quiescence search resolves the captures, so a hanging piece is never the last word.
+ * A node limit stops the search in the middle of an iteration, its result is thrown away.
+ *
+ * Lazy SMP: helper threads run the same iterative deepening on their own position and stacks, every other one
+ * a ply deeper, and only talk through the transposition table. What one thread stores shortens or reorders the
+ * others' trees, so they drift apart and fill the table with different lines. The deepest completed iteration
+ * of any thread is the result, ties go to the higher score.
+ */
+#define SEARCH_NODE_BATCH 1024 // nodes a thread counts before it adds them to the shared total
+#define SEARCH_DELTA_MARGIN 200 // positional swing a capture may bring on top of the captured piece
+
+typedef struct
+{
+	SearchLimits limits;
+	unsigned long long nodes; // flushed by every thread in batches
+	bool stop;
+} SearchShared;
+
+typedef struct
+{
+	Position* position;       // &root
+	Position root;            // copy of the searched position on `history`
+	PositionUndo history[MAX_PLY];
+	SearchLimits limits;
+	SearchTable* table;       // may be NULL
+	SearchShared* shared;     // NULL without helper threads
+	unsigned int index;       // thread, 0 is the one that called position_search
+	unsigned long long nodes;
+	unsigned long long reported; // nodes already added to the shared total
+	bool stopped;
+	Move killers[SEARCH_MAX_PLY][2];
+	Move pv[SEARCH_MAX_PLY + 1][SEARCH_MAX_PLY]; // [ply] best line found below that ply
+	unsigned char pv_length[SEARCH_MAX_PLY + 1];
+	Move previous_pv[SEARCH_MAX_PLY];            // of the last completed iteration
+	unsigned char previous_pv_length;
+	SearchResult result;                         // last completed iteration
+} SearchContext;
+
+// Fifty moves, or a position repeated since the last capture or pawn move. Once in the line is enough to score it a draw
+static bool search_is_draw(const Position* position)
+{
+	if (position->halfmove_clock >= 100) return true;
+
+	const int reversible = position->halfmove_clock < position->ply ? position->halfmove_clock : position->ply;
+	for (int i = 4; i <= reversible; i += 2)
+	{
+		if (position->history[position->ply - i].hash == position->hash) return true;
+	}
+
+	return false;
+}
+
+// Alone the node limit is exact, threads only meet every SEARCH_NODE_BATCH nodes and overshoot it by less than a batch each
+static inline bool search_should_stop(SearchContext* context)
+{
+	SearchShared* shared = context->shared;
+	if (shared == NULL) return context->limits.nodes && context->nodes >= context->limits.nodes;
+
+	if (context->nodes - context->reported >= SEARCH_NODE_BATCH)
+	{
+		const unsigned long long total = __atomic_add_fetch(&shared->nodes, context->nodes - context->reported, __ATOMIC_RELAXED);
+		context->reported = context->nodes;
+		if (shared->limits.nodes && total >= shared->limits.nodes) __atomic_store_n(&shared->stop, true, __ATOMIC_RELAXED);
+	}
+
+	return __atomic_load_n(&shared->stop, __ATOMIC_RELAXED);
+}
+
+// Material a capture or promotion wins, the delta pruning bound
+static inline int search_capture_gain(const Position* position, const Move move)
+{
+	const char victim = position->board[GET_TO(move)];
+	int gain = GET_TYPE(move) == EN_PASSANT ? PIECE_VALUES[PIECE_PAWN] : victim != ' ' ? PIECE_VALUES[PIECE_TYPE(victim)] : 0;
+
+	if (GET_TYPE(move) == PROMOTION) gain += PIECE_VALUES[PROMOTION_TO_PIECE(GET_PROM(move))] - PIECE_VALUES[PIECE_PAWN];
+	return gain;
+}
+
+/*
+ * Quiescence search: only captures and promotions, best victim first, until the position is quiet. The side to
+ * move may stand pat on its evaluation, and captures that can not lift it to alpha even with a margin are pruned.
+ * In check there is no standing pat, every evasion is searched instead.
+ */
+static int search_quiescence(SearchContext* context, int alpha, const int beta, const int ply)
+{
+	Position* position = context->position;
+	context->pv_length[ply] = 0;
+
+	if (search_should_stop(context))
+	{
+		context->stopped = true;
+		return 0;
+	}
+	context->nodes++;
+
+	if (ply >= SEARCH_MAX_PLY - 1 || position->ply >= position->history_size - 1) return position_evaluate(position);
+
+	Move moves[MAX_VALID_MOVES];
+	short scores[MAX_VALID_MOVES];
+	unsigned char count = 0;
+
+	const bool in_check = position_is_in_check(position, position->player);
+	int best_score = -SEARCH_INFINITE;
+	int stand_pat = 0;
+
+	if (in_check)
+	{
+		position_generate_evasions(position, moves, &count, position->player, position_en_passant_move(position));
+		if (count == 0) return -SEARCH_MATE + ply;
+	}
+	else
+	{
+		stand_pat = position_evaluate(position);
+		if (stand_pat >= beta) return stand_pat;
+
+		// Not even a queen brings the score back, unless a pawn is about to promote
+		const Bitboard promoting = position->pieces[position->player][PIECE_PAWN] & ROW_BB(position->player == WHITE ? 1 : 6);
+		if (!promoting && stand_pat + PIECE_VALUES[PIECE_QUEEN] + SEARCH_DELTA_MARGIN <= alpha) return stand_pat;
+
+		if (stand_pat > alpha) alpha = stand_pat;
+		best_score = stand_pat;
+
+		position_generate_captures(position, moves, &count, position->player, position_en_passant_move(position));
+	}
+
+	for (unsigned char i = 0; i < count; i++)
+	{
+		scores[i] = move_generator_score(position, moves[i]);
+	}
+
+	for (unsigned char index = 0; index < count; index++)
+	{
+		// Selection sort, a cutoff leaves the rest unsorted
+		unsigned char best = index;
+		for (unsigned char i = index + 1; i < count; i++)
+		{
+			if (scores[i] > scores[best]) best = i;
+		}
+
+		const Move move = moves[best];
+		moves[best] = moves[index];
+		scores[best] = scores[index];
+
+		if (!in_check && stand_pat + search_capture_gain(position, move) + SEARCH_DELTA_MARGIN <= alpha) continue;
+
+		position_push(position, move);
+		const int score = -search_quiescence(context, -beta, -alpha, ply + 1);
+		position_pop(position);
+
+		if (context->stopped) return 0;
+		if (score <= best_score) continue;
+
+		best_score = score;
+		if (score <= alpha) continue;
+
+		alpha = score;
+		context->pv[ply][0] = move;
+		memcpy(&context->pv[ply][1], context->pv[ply + 1], context->pv_length[ply + 1] * sizeof(Move));
+		context->pv_length[ply] = context->pv_length[ply + 1] + 1;
+
+		if (score >= beta) break;
+	}
+
+	return best_score;
+}
+
+static int search_node(SearchContext* context, int depth, int alpha, const int beta, const int ply, const bool on_pv)
+{
+	Position* position = context->position;
+
+	// Checks are extended, a line does not end while the king is attacked
+	const bool in_check = position_is_in_check(position, position->player);
+	if (in_check) depth++;
+
+	if (depth <= 0) return search_quiescence(context, alpha, beta, ply);
+
+	context->pv_length[ply] = 0;
+
+	if (search_should_stop(context))
+	{
+		context->stopped = true;
+		return 0;
+	}
+	context->nodes++;
+
+	if (ply > 0 && search_is_draw(position)) return 0;
+	if (ply >= SEARCH_MAX_PLY - 1 || position->ply >= position->history_size - 1) return position_evaluate(position);
+
+	const Move pv_move = on_pv && ply < context->previous_pv_length ? context->previous_pv[ply] : NO_MOVE;
+	const int original_alpha = alpha;
+	Move hash_move = NO_MOVE;
+
+	unsigned long long data;
+	if (context->table != NULL && search_table_probe(context->table, position->hash, &data))
+	{
+		const int score = search_score_from_table(SEARCH_ENTRY_SCORE(data), ply);
+		const int bound = SEARCH_ENTRY_BOUND(data);
+
+		hash_move = SEARCH_ENTRY_MOVE(data);
+		if (beta - alpha == 1 && SEARCH_ENTRY_DEPTH(data) >= depth &&
+			(bound == SEARCH_BOUND_EXACT || (bound == SEARCH_BOUND_LOWER && score >= beta) || (bound == SEARCH_BOUND_UPPER && score <= alpha)))
+		{
+			return score;
+		}
+	}
+
+	MoveGenerator generator;
+	move_generator_init(&generator, position, position->player, position->castle, position_en_passant_move(position),
+	                    pv_move != NO_MOVE ? pv_move : hash_move, context->killers[ply]);
+
+	int best_score = -SEARCH_INFINITE;
+	int move_count = 0;
+	Move best_move = NO_MOVE;
+
+	for (Move move; (move = move_generator_next(&generator)) != NO_MOVE;)
+	{
+		const bool quiet = position->board[GET_TO(move)] == ' ' && GET_TYPE(move) != EN_PASSANT && GET_TYPE(move) != PROMOTION;
+		int score;
+
+		position_push(position, move);
+
+		// The first move gets the full window, the rest only have to prove they are not better
+		if (move_count++ == 0)
+		{
+			score = -search_node(context, depth - 1, -beta, -alpha, ply + 1, on_pv && move == pv_move);
+		}
+		else
+		{
+			score = -search_node(context, depth - 1, -alpha - 1, -alpha, ply + 1, false);
+			if (score > alpha && score < beta) score = -search_node(context, depth - 1, -beta, -alpha, ply + 1, false);
+		}
+
+		position_pop(position);
+
+		if (context->stopped) return 0;
+		if (score <= best_score) continue;
+
+		best_score = score;
+		if (score <= alpha) continue;
+
+		alpha = score;
+		best_move = move;
+		context->pv[ply][0] = move;
+		memcpy(&context->pv[ply][1], context->pv[ply + 1], context->pv_length[ply + 1] * sizeof(Move));
+		context->pv_length[ply] = context->pv_length[ply + 1] + 1;
+
+		if (score >= beta)
+		{
+			if (quiet && move != context->killers[ply][0])
+			{
+				context->killers[ply][1] = context->killers[ply][0];
+				context->killers[ply][0] = move;
+			}
+			break;
+		}
+	}
+
+	// Mated sooner is worse, so the shortest mate is preferred
+	if (move_count == 0) return in_check ? -SEARCH_MATE + ply : 0;
+
+	if (context->table != NULL)
+	{
+		const int bound = best_score >= beta ? SEARCH_BOUND_LOWER : best_score > original_alpha ? SEARCH_BOUND_EXACT : SEARCH_BOUND_UPPER;
+		search_table_store(context->table, position->hash, best_move, search_score_to_table(best_score, ply), depth, bound);
+	}
+
+	return best_score;
+}
+
+// Iterative deepening into context->result, helpers with an odd index search every iteration one ply deeper
+static void search_iterate(SearchContext* context)
+{
+	const int offset = context->index & 1;
+	const int max_depth = context->limits.depth > 0 && context->limits.depth < SEARCH_MAX_DEPTH ? context->limits.depth : SEARCH_MAX_DEPTH;
+	SearchResult* result = &context->result;
+
+	// Helpers keep going until the first thread is done, a deeper iteration of theirs is welcome
+	for (int depth = 1 + offset; depth <= (context->index ? SEARCH_MAX_DEPTH : max_depth); depth++)
+	{
+		const int score = search_node(context, depth, -SEARCH_INFINITE, SEARCH_INFINITE, 0, true);
+		if (context->stopped) break;
+
+		result->best_move = context->pv[0][0];
+		result->score = score;
+		result->depth = depth;
+		result->pv_length = context->pv_length[0];
+		memcpy(result->pv, context->pv[0], context->pv_length[0] * sizeof(Move));
+
+		memcpy(context->previous_pv, context->pv[0], context->pv_length[0] * sizeof(Move));
+		context->previous_pv_length = context->pv_length[0];
+
+		// A mate this close will not change with more depth
+		if (SEARCH_IS_MATE(score) && SEARCH_MATE - ABS(score) <= depth) break;
+	}
+}
+
+#ifdef CHESS_THREADS_AVAILABLE
+static void* search_worker(void* argument)
+{
+	SearchContext* context = argument;
+	search_iterate(context);
+	return NULL;
+}
+#endif // CHESS_THREADS_AVAILABLE
+
+CHESSDEF Move position_search(Position* position, const SearchLimits* limits, SearchTable* table, SearchResult* result)
+{
+	SearchResult local_result;
+	if (result == NULL) result = &local_result;
+	memset(result, 0, sizeof(SearchResult));
+
+	const double start = perft_seconds();
+
+	Move valid_moves[MAX_VALID_MOVES];
+	unsigned char count = 0;
+	position_legal_moves(position, valid_moves, &count);
+
+	if (count == 0)
+	{
+		result->score = position_is_in_check(position, position->player) ? -SEARCH_MATE : 0;
+		return NO_MOVE;
+	}
+
+	if (table != NULL && table->entries == NULL) table = NULL;
+	if (table != NULL) table->age++;
+
+	// Helpers only help through the table
+	unsigned int threads = limits->threads > 1 && table != NULL ? limits->threads : 1;
+	if (threads > SEARCH_MAX_THREADS) threads = SEARCH_MAX_THREADS;
+#ifndef CHESS_THREADS_AVAILABLE
+	threads = 1;
+#endif // CHESS_THREADS_AVAILABLE
+
+	SearchShared shared = { .limits = *limits };
+	SearchContext* contexts[SEARCH_MAX_THREADS] = { NULL };
+
+	// Repetitions are only looked for since the last capture or pawn move, older records are left behind
+	unsigned short kept = position->ply < MAX_PLY - SEARCH_MAX_PLY ? position->ply : MAX_PLY - SEARCH_MAX_PLY;
+	if (kept > position->halfmove_clock) kept = position->halfmove_clock;
+
+	// Every thread searches its own copy of the position on its own undo stack, one that can not be allocated is left out
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		contexts[i] = calloc(1, sizeof(SearchContext));
+		if (contexts[i] == NULL) continue;
+
+		contexts[i]->root = *position;
+		if (kept > 0) memcpy(contexts[i]->history, position->history + position->ply - kept, kept * sizeof(PositionUndo));
+		contexts[i]->root.history = contexts[i]->history;
+		contexts[i]->root.history_size = MAX_PLY;
+		contexts[i]->root.ply = kept;
+
+		contexts[i]->position = &contexts[i]->root;
+		contexts[i]->limits = *limits;
+		contexts[i]->table = table;
+		contexts[i]->shared = threads > 1 ? &shared : NULL;
+		contexts[i]->index = i;
+	}
+
+	SearchContext* context = contexts[0];
+	if (context == NULL)
+	{
+		for (unsigned int i = 1; i < threads; i++) free(contexts[i]);
+
+		result->best_move = valid_moves[0];
+		return result->best_move;
+	}
+
+#ifdef CHESS_THREADS_AVAILABLE
+	pthread_t handles[SEARCH_MAX_THREADS];
+	bool started[SEARCH_MAX_THREADS] = { false };
+
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		if (contexts[i] != NULL) started[i] = pthread_create(&handles[i], NULL, search_worker, contexts[i]) == 0;
+	}
+#endif // CHESS_THREADS_AVAILABLE
+
+	search_iterate(context);
+
+	// The first thread decides when the search is over
+	__atomic_store_n(&shared.stop, true, __ATOMIC_RELAXED);
+
+	*result = context->result;
+	unsigned long long nodes = context->nodes;
+
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		if (contexts[i] == NULL) continue;
+
+#ifdef CHESS_THREADS_AVAILABLE
+		if (started[i]) pthread_join(handles[i], NULL);
+#endif // CHESS_THREADS_AVAILABLE
+
+		const SearchResult* helper = &contexts[i]->result;
+		if (helper->depth > result->depth || (helper->depth == result->depth && helper->depth > 0 && helper->score > result->score))
+		{
+			*result = *helper;
+		}
+		nodes += contexts[i]->nodes;
+
+		free(contexts[i]);
+	}
+
+	// Stopped before the first iteration finished: a root move that was searched to the end, else any legal one
+	if (result->best_move == NO_MOVE)
+	{
+		result->best_move = context->pv_length[0] ? context->pv[0][0] : valid_moves[0];
+		result->pv[0] = result->best_move;
+		result->pv_length = 1;
+	}
+
+	result->nodes = nodes;
+	result->seconds = perft_seconds() - start;
+
+	free(context);
+	return result->best_move;
+}
+
+#endif // CHESS_IMPLEMENTATION
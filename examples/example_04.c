@@ -0,0 +1,65 @@
+/*
+ * Perft divide: prints the node count below every root move as soon as it is known
+ *
+ *   example_04 <depth> [threads] [fen]
+ *
+ * `threads` 0 (default) uses every online CPU, the FEN defaults to the starting position.
+ * Compare the output against another engine's `go perft <depth>` to find the move a count goes wrong under.
+ */
+
+#define CHESS_IMPLEMENTATION
+#include "chess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void print_root_move(const Move move, const unsigned long long nodes, const double seconds, void* data)
+{
+    (void)data;
+
+    char uci[6];
+    move_to_UCI(move, uci);
+
+    // Flushed right away so a slow subtree does not hide the ones that already finished
+    printf("%s: %llu\t%.3fs\t%.0f nps\n", uci, nodes, seconds, seconds > 0 ? nodes / seconds : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <depth> [threads] [fen]\n", argv[0]);
+        return 1;
+    }
+
+    const int depth = atoi(argv[1]);
+    const unsigned int threads = argc > 2 ? (unsigned int)atoi(argv[2]) : 0;
+
+    // Starting position unless a FEN is given
+    char board[64];
+    Player player = WHITE;
+    Castle castle = INITIAL_CASTLE;
+    Move last_move = NO_MOVE;
+
+    COPY_BOARD(board, INITIAL_BOARD);
+    if (argc > 3 && !parse_fen(argv[3], board, &player, &castle, &last_move))
+    {
+        fprintf(stderr, "invalid FEN: %s\n", argv[3]);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const unsigned long long nodes = perft_divide(board, depth, player, castle, last_move, true, threads, print_root_move, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("\nNodes searched: %llu\n", nodes);
+    printf("Time: %.3fs\n", seconds);
+    printf("NPS: %.0f\n", seconds > 0 ? nodes / seconds : 0.0);
+
+    return 0;
+}
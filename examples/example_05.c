@@ -0,0 +1,259 @@
+/*
+ * Perft suite runner: streams an EPD file of positions with expected counts, runs the positions on a
+ * pool of threads and prints one record per (position, depth) as JSON or CSV
+ *
+ *   example_05 <file.epd> [--depth N] [--threads N] [--format json|csv] [--cache FILE] [--cache-mb N]
+ *
+ * Every EPD line is a FEN followed by `;D<depth> <nodes>` operations, see examples/perft_suite.epd.
+ * `--depth` skips deeper operations, `--threads` 0 (default) uses every online CPU.
+ * `--cache` keeps subtree counts in a memory-mapped perft table file (`--cache-mb` sizes a new one, 256 by default),
+ * a warm cache answers repeated runs almost instantly and can be shared by concurrent runs.
+ * Exits with 1 when a count differs or a line can not be parsed, so it can gate a build.
+ */
+
+#define CHESS_IMPLEMENTATION
+#include "chess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SUITE_MAX_LINE 1024
+#define SUITE_MAX_DEPTH 16
+
+typedef struct
+{
+    FILE* input;
+    unsigned int line;       // lines read so far
+    int max_depth;
+    bool json;
+    const char* cache;       // perft table file, NULL to count without one
+    size_t cache_megabytes;
+
+    pthread_mutex_t lock;    // guards everything below, the input and stdout
+    unsigned int records;
+    unsigned int failures;
+    unsigned long long nodes;
+} Suite;
+
+static double suite_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// FENs of invalid lines may hold anything, quotes are escaped for both formats
+static void suite_print_string(const char* text, const bool json)
+{
+    putchar('"');
+    for (; *text; text++)
+    {
+        if (json && (*text == '"' || *text == '\\')) putchar('\\');
+        else if (!json && *text == '"') putchar('"');
+
+        if ((unsigned char)*text >= ' ') putchar(*text);
+    }
+    putchar('"');
+}
+
+// Prints one record, the caller holds the lock
+static void suite_print(Suite* suite, const unsigned int line, const char* fen, const int depth, const unsigned long long expected,
+                        const unsigned long long nodes, const double seconds, const char* result)
+{
+    const double nps = seconds > 0 ? nodes / seconds : 0.0;
+
+    if (suite->json)
+    {
+        printf("%s\n  {\"line\": %u, \"fen\": ", suite->records ? "," : "", line);
+        suite_print_string(fen, true);
+        printf(", \"depth\": %d, \"expected\": %llu, \"nodes\": %llu, \"seconds\": %.6f, \"nps\": %.0f, \"result\": \"%s\"}",
+               depth, expected, nodes, seconds, nps, result);
+    }
+    else
+    {
+        printf("%u,", line);
+        suite_print_string(fen, false);
+        printf(",%d,%llu,%llu,%.6f,%.0f,%s\n", depth, expected, nodes, seconds, nps, result);
+    }
+
+    suite->records++;
+    fflush(stdout);
+}
+
+// Splits an EPD line into the FEN and its `;D<depth> <nodes>` operations, `expected` is 0 for depths that are not given
+static bool suite_parse(char* text, char** fen, unsigned long long expected[SUITE_MAX_DEPTH + 1])
+{
+    memset(expected, 0, (SUITE_MAX_DEPTH + 1) * sizeof(unsigned long long));
+
+    char* operations = strchr(text, ';');
+    if (operations != NULL) *operations++ = '\0';
+
+    // Trailing white space and the new line are not part of the FEN
+    size_t length = strlen(text);
+    while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\n' || text[length - 1] == '\r' || text[length - 1] == '\t')) text[--length] = '\0';
+    while (*text == ' ' || *text == '\t') text++;
+    *fen = text;
+
+    for (char* operation = operations; operation != NULL; )
+    {
+        char* next = strchr(operation, ';');
+        if (next != NULL) *next++ = '\0';
+
+        int depth;
+        unsigned long long nodes;
+        if (sscanf(operation, " D%d %llu", &depth, &nodes) != 2 || depth < 1 || depth > SUITE_MAX_DEPTH) return false;
+        expected[depth] = nodes;
+
+        operation = next;
+    }
+
+    return true;
+}
+
+static void* suite_worker(void* argument)
+{
+    Suite* suite = argument;
+
+    // Every worker plays moves on its own position
+    Position* position = malloc(sizeof(Position));
+    if (position == NULL) return NULL;
+
+    // Every worker maps the cache file on its own, the table statistics are not shared
+    PerftTable table = { 0 };
+    if (suite->cache != NULL && !perft_table_open(&table, suite->cache, suite->cache_megabytes))
+    {
+        fprintf(stderr, "can not open the cache %s, counting without it\n", suite->cache);
+    }
+
+    char text[SUITE_MAX_LINE];
+    unsigned long long expected[SUITE_MAX_DEPTH + 1];
+
+    while (true)
+    {
+        // Lines are read one at a time, the file is never loaded as a whole
+        pthread_mutex_lock(&suite->lock);
+        const bool read = fgets(text, sizeof(text), suite->input) != NULL;
+        const unsigned int line = ++suite->line;
+        pthread_mutex_unlock(&suite->lock);
+
+        if (!read) break;
+
+        char* fen;
+        char board[64];
+        Player player;
+        Castle castle;
+        Move last_move;
+
+        if (!suite_parse(text, &fen, expected) || !parse_fen(fen, board, &player, &castle, &last_move))
+        {
+            if (*fen == '\0' || *fen == '#') continue; // empty lines and comments
+
+            pthread_mutex_lock(&suite->lock);
+            suite_print(suite, line, fen, 0, 0, 0, 0, "invalid");
+            suite->failures++;
+            pthread_mutex_unlock(&suite->lock);
+            continue;
+        }
+
+        position_set(position, board, player, castle, last_move);
+
+        for (int depth = 1; depth <= suite->max_depth; depth++)
+        {
+            if (expected[depth] == 0) continue;
+
+            const double start = suite_seconds();
+            const unsigned long long nodes = table.entries != NULL
+                ? position_perft_hashed(position, depth, player, castle, last_move, true, &table)
+                : position_perft(position, depth, player, castle, last_move, true);
+            const double seconds = suite_seconds() - start;
+            const bool passed = nodes == expected[depth];
+
+            pthread_mutex_lock(&suite->lock);
+            suite_print(suite, line, fen, depth, expected[depth], nodes, seconds, passed ? "pass" : "fail");
+            suite->nodes += nodes;
+            if (!passed) suite->failures++;
+            pthread_mutex_unlock(&suite->lock);
+        }
+    }
+
+    perft_table_free(&table);
+    free(position);
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <file.epd> [--depth N] [--threads N] [--format json|csv] [--cache FILE] [--cache-mb N]\n", argv[0]);
+        return 1;
+    }
+
+    Suite suite = { .max_depth = SUITE_MAX_DEPTH, .json = true, .cache_megabytes = 256 };
+    unsigned int threads = 0;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--depth") == 0) suite.max_depth = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--threads") == 0) threads = (unsigned int)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--format") == 0) suite.json = strcmp(argv[i + 1], "csv") != 0;
+        else if (strcmp(argv[i], "--cache") == 0) suite.cache = argv[i + 1];
+        else if (strcmp(argv[i], "--cache-mb") == 0) suite.cache_megabytes = (size_t)atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (suite.max_depth > SUITE_MAX_DEPTH) suite.max_depth = SUITE_MAX_DEPTH;
+
+    suite.input = fopen(argv[1], "r");
+    if (suite.input == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (threads == 0)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    if (threads > PERFT_MAX_THREADS) threads = PERFT_MAX_THREADS;
+
+    // Tables are filled before the clock starts
+    init_attack_tables();
+    pthread_mutex_init(&suite.lock, NULL);
+
+    if (suite.json) printf("[");
+    else printf("line,fen,depth,expected,nodes,seconds,nps,result\n");
+
+    const double start = suite_seconds();
+
+    pthread_t handles[PERFT_MAX_THREADS];
+    bool started[PERFT_MAX_THREADS] = { false };
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        started[i] = pthread_create(&handles[i], NULL, suite_worker, &suite) == 0;
+    }
+    suite_worker(&suite);
+
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        if (started[i]) pthread_join(handles[i], NULL);
+    }
+
+    const double seconds = suite_seconds() - start;
+    if (suite.json) printf("\n]\n");
+
+    fprintf(stderr, "%u records, %u failed, %llu nodes in %.3fs (%.0f nps)\n",
+            suite.records, suite.failures, suite.nodes, seconds, seconds > 0 ? suite.nodes / seconds : 0.0);
+
+    pthread_mutex_destroy(&suite.lock);
+    fclose(suite.input);
+
+    return suite.failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Resumable perft: counts with a journal of finished work units and prints progress with an ETA
+ *
+ *   example_06 <depth> <journal> [threads] [split_ply] [fen]
+ *
+ * Interrupt it at any time and run the same command again, units already in the journal are not counted twice.
+ * `threads` 0 (default) uses every online CPU, `split_ply` 0 (default) splits the root PERFT_DEFAULT_SPLIT_PLY plies deep.
+ */
+
+#define CHESS_IMPLEMENTATION
+#include "chess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void print_progress(const PerftProgress* progress, void* data)
+{
+    (void)data;
+
+    fprintf(stderr, "\r[%u/%u] %5.1f%%  %llu nodes  %.0fs elapsed  ",
+            progress->units_done, progress->unit_count, 100.0 * progress->units_done / progress->unit_count, progress->nodes, progress->seconds);
+
+    if (progress->eta >= 0) fprintf(stderr, "%.0fs left   ", progress->eta);
+    fflush(stderr);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <depth> <journal> [threads] [split_ply] [fen]\n", argv[0]);
+        return 1;
+    }
+
+    const int depth = atoi(argv[1]);
+    const char* path = argv[2];
+    const unsigned int threads = argc > 3 ? (unsigned int)atoi(argv[3]) : 0;
+    const unsigned int split_ply = argc > 4 ? (unsigned int)atoi(argv[4]) : 0;
+
+    // Starting position unless a FEN is given
+    char board[64];
+    Player player = WHITE;
+    Castle castle = INITIAL_CASTLE;
+    Move last_move = NO_MOVE;
+
+    COPY_BOARD(board, INITIAL_BOARD);
+    if (argc > 5 && !parse_fen(argv[5], board, &player, &castle, &last_move))
+    {
+        fprintf(stderr, "invalid FEN: %s\n", argv[5]);
+        return 1;
+    }
+
+    unsigned long long nodes;
+    if (!perft_journal(board, depth, player, castle, last_move, true, path, threads, split_ply, print_progress, NULL, &nodes))
+    {
+        fprintf(stderr, "\ncan not use the journal %s (unwritable, or written by another job)\n", path);
+        return 1;
+    }
+
+    fprintf(stderr, "\n");
+    printf("Nodes searched: %llu\n", nodes);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Best move: iterative deepening alpha-beta search of a position
+ *
+ *   example_08 <depth> [nodes] [threads] [fen]
+ *
+ * `depth` 0 searches until the node limit, `nodes` 0 (default) has none. The FEN defaults to the starting position.
+ * The search uses a 64 MB transposition table, shared by `threads` (1 by default, 0 for every online CPU) Lazy SMP threads.
+ */
+
+#define CHESS_IMPLEMENTATION
+#include "chess.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <depth> [nodes] [threads] [fen]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int threads = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    if (threads == 0)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    const SearchLimits limits = {
+        .depth = atoi(argv[1]),
+        .nodes = argc > 2 ? strtoull(argv[2], NULL, 10) : 0,
+        .threads = threads,
+    };
+
+    // Starting position unless a FEN is given
+    char board[64];
+    Player player = WHITE;
+    Castle castle = INITIAL_CASTLE;
+    Move last_move = NO_MOVE;
+
+    COPY_BOARD(board, INITIAL_BOARD);
+    if (argc > 4 && !parse_fen(argv[4], board, &player, &castle, &last_move))
+    {
+        fprintf(stderr, "invalid FEN: %s\n", argv[4]);
+        return 1;
+    }
+
+    if (limits.depth <= 0 && limits.nodes == 0)
+    {
+        fprintf(stderr, "a depth or a node limit is needed\n");
+        return 1;
+    }
+
+    SearchTable table;
+    if (!search_table_init(&table, 64))
+    {
+        fprintf(stderr, "can not allocate the transposition table\n");
+        return 1;
+    }
+
+    SearchResult result;
+    const Move best_move = search_best_move(board, player, castle, last_move, &limits, &table, &result);
+    const int hashfull = search_table_hashfull(&table);
+    search_table_free(&table);
+
+    char uci[6];
+    printf("depth %d ", result.depth);
+    if (SEARCH_IS_MATE(result.score)) printf("score mate %d ", result.score > 0 ? (SEARCH_MATE - result.score + 1) / 2 : -(SEARCH_MATE + result.score) / 2);
+    else printf("score cp %d ", result.score);
+    printf("nodes %llu time %.3fs nps %.0f hashfull %d pv", result.nodes, result.seconds, result.seconds > 0 ? result.nodes / result.seconds : 0.0, hashfull);
+
+    for (unsigned char i = 0; i < result.pv_length; i++)
+    {
+        move_to_UCI(result.pv[i], uci);
+        printf(" %s", uci);
+    }
+    putchar('\n');
+
+    if (best_move == NO_MOVE)
+    {
+        printf("bestmove (none)\n");
+        return 0;
+    }
+
+    move_to_UCI(best_move, uci);
+    printf("bestmove %s\n", uci);
+
+    return 0;
+}
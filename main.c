@@ -10,26 +10,6 @@
 
 extern void run_tests();
 
-bool is_capture_move_better(char board[64], const Move move)
-{
-	// printf("from: %d\n", GET_FROM(move));
-	char temp = board[GET_TO(move)];
-	board[GET_TO(move)] = ' ';
-	bool is_not_attacked = !is_attacked(board, GET_TO(move), IS_WHITE_PIECE(board[GET_FROM(move)]) ? BLACK : WHITE);
-	board[GET_TO(move)] = temp;
-	return is_not_attacked;
-}
-
-bool is_capture_move_better_ult(char board[64], const Move move)
-{
-	// printf("from: %d\n", GET_FROM(move));
-	char temp = board[GET_TO(move)];
-	board[GET_TO(move)] = ' ';
-	bool is_not_attacked = !is_attacked(board, GET_TO(move), IS_WHITE_PIECE(board[GET_FROM(move)]) ? BLACK : WHITE);
-	board[GET_TO(move)] = temp;
-	return is_not_attacked && board[GET_TO(move)] != ' ';
-}
-
 int main(void)
 {
     for (int i = 0; i < 64; i++) {
@@ -74,19 +54,19 @@ int main(void)
 	bool run_games = true;
 	while (run_games)
 	{
-		COPY_BOARD(board, INITIAL_BOARD);
+		static Position position;
+		static PositionUndo history[MAX_PLY];
+		position_set(&position, INITIAL_BOARD, WHITE, INITIAL_CASTLE, NO_MOVE);
+		position_set_history(&position, history, MAX_PLY);
 
 		Move valid_moves[MAX_VALID_MOVES];
 		uint8_t count;
-		Castle castle = INITIAL_CASTLE;
 		Move last_move = 0;
-		Player player = WHITE;
 		int move_counter = 0;
 
-		for (int i = 0; i < 1024; i++)
+		for (int i = 0; i < MAX_PLY; i++)
 		{
-			update_castle(board, &castle);
-			generate_valid_moves(board, valid_moves, &count, player, castle, last_move);
+			position_legal_moves(&position, valid_moves, &count);
 			if (count == 0)
 			{
 				printf("\n----------------------");
@@ -94,14 +74,12 @@ int main(void)
 				exit(0);
 			}
 
-			last_move = valid_moves[rand() % count];
-
-			filter_moves(board, valid_moves, &count, is_capture_move_better_ult);
+			// A short search per move, the node limit keeps every move equally fast
+			static SearchTable table;
+			if (table.entries == NULL) search_table_init(&table, 16);
 
-			if (count != 0)
-			{
-				last_move = valid_moves[rand() % count];
-			}
+			const SearchLimits limits = { .nodes = 200000 };
+			last_move = position_search(&position, &limits, &table, NULL);
 
 			// char notation[16] = {0};
 			// move_to_PGN(last_move, board, valid_moves, count, notation);
@@ -113,7 +91,7 @@ int main(void)
 
 			// printf("`%s`", MOVE_TO_STRING(last_move));
 
-			make_move(board, last_move);
+			position_push(&position, last_move);
 
 			// printf("%c%d%c%d",
 			// 	(GET_COL(GET_FROM(last_move))) + 'a',   // Convert column to 'a' - 'h'
@@ -130,8 +108,7 @@ int main(void)
 			move_counter++;
 			putchar(move_counter % 2 == 0  ? 10 : ' ');
 
-			// print_board(board);
-			player = SWITCH_PLAYER(player);
+			// print_board(position.board);
 		}
 		// is_enpassant = true;
 		run_games = false;
@@ -3,34 +3,57 @@
  * Test cases sourced from: https://www.chessprogramming.org/Perft_Results
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 
 // #include "chess_header_only.h"
 
 #include "chess.h"
 
+// Same POSIX condition as CHESS_MMAP_AVAILABLE, temporary files come from mkstemp with it
+#if defined(__APPLE__) || (defined(__unix__) && defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L)
+#define TEST_POSIX_AVAILABLE
+#include <unistd.h>
+#endif
+
+// perft_table_open fails by design without it
+#if defined(TEST_POSIX_AVAILABLE) && !defined(CHESS_NO_MMAP)
+#define TEST_MMAP_AVAILABLE
+#endif
+
 #define RESET_COLOR    "\033[0m"
 #define GREEN_COLOR    "\033[32m"
 #define RED_COLOR      "\033[31m"
 #define YELLOW_COLOR   "\033[33m"
 
-void test_passed(const char *test_name, int expected, int actual, double time_taken) {
-	printf("%s[PASS]%s %s\t- Expected: %-10d Got: %-10d Time: %.5f seconds\n", GREEN_COLOR, RESET_COLOR, test_name, expected, actual, time_taken);
+void test_passed(const char *test_name, unsigned long long expected, unsigned long long actual, double time_taken) {
+	printf("%s[PASS]%s %s\t- Expected: %-10llu Got: %-10llu Time: %.5f seconds\n", GREEN_COLOR, RESET_COLOR, test_name, expected, actual, time_taken);
 }
 
-void test_failed(const char *test_name, int expected, int actual, double time_taken) {
-	printf("%s[FAIL]%s %s\t- Expected: %-10d Got: %-10d Time: %.5f seconds\n", RED_COLOR, RESET_COLOR, test_name, expected, actual, time_taken);
+void test_failed(const char *test_name, unsigned long long expected, unsigned long long actual, double time_taken) {
+	printf("%s[FAIL]%s %s\t- Expected: %-10llu Got: %-10llu Time: %.5f seconds\n", RED_COLOR, RESET_COLOR, test_name, expected, actual, time_taken);
 }
 
+// Wall clock, clock() adds up the CPU time of every perft_parallel thread
+double test_seconds(void) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// `actual` is evaluated exactly once, between the two clock readings
 #define assert_equal(actual, expected) \
 do { \
-	clock_t start_time = clock(); \
-	if ((actual) != (expected)) { \
-		test_failed(__func__, (expected), (actual), ((double)(clock() - start_time)) / CLOCKS_PER_SEC); \
+	const double start_time = test_seconds(); \
+	const unsigned long long actual_value = (actual); \
+	const double time_taken = test_seconds() - start_time; \
+	if (actual_value != (unsigned long long)(expected)) { \
+		test_failed(__func__, (expected), actual_value, time_taken); \
 		/*return;*/ \
 	} else { \
-		test_passed(__func__, (expected), (actual), ((double)(clock() - start_time)) / CLOCKS_PER_SEC); \
+		test_passed(__func__, (expected), actual_value, time_taken); \
 	} \
 } while (0)
 
@@ -159,6 +182,672 @@ uint64_t test_knight(const int depth, Player player)
 	return perft(board, depth, player, INITIAL_CASTLE, 0, false);
 }
 
+uint64_t test_parallel_initial_position(const int depth, Player player, unsigned int threads, unsigned int split_ply)
+{
+	char board[64];
+	COPY_BOARD(board, INITIAL_BOARD);
+
+	return perft_parallel(board, depth, player, INITIAL_CASTLE, 0, true, threads, split_ply, NULL);
+}
+
+uint64_t test_parallel_knight(const int depth, Player player, unsigned int threads, unsigned int split_ply)
+{
+	char board[64];
+	memset(board, ' ', sizeof(board));
+	board[63] = 'N';
+
+	return perft_parallel(board, depth, player, INITIAL_CASTLE, 0, false, threads, split_ply, NULL);
+}
+
+uint64_t test_hashed(const char board[64], const int depth, Player player, const bool switch_player)
+{
+	static PerftTable table;
+	if (table.entries == NULL && !perft_table_init(&table, 16)) return 0;
+
+	char copy[64];
+	COPY_BOARD(copy, board);
+	perft_table_clear(&table);
+
+	return perft_hashed(copy, depth, player, INITIAL_CASTLE, 0, switch_player, &table);
+}
+
+// Counts with switch_player off and then on through one table that is never cleared, the second count is returned
+uint64_t test_hashed_mixed(const char* fen, const int depth)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	PerftTable table;
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move) || !perft_table_init(&table, 16)) return 0;
+
+	perft_hashed(board, depth, player, castle, last_move, false, &table);
+	const uint64_t nodes = perft_hashed(board, depth, player, castle, last_move, true, &table);
+	perft_table_free(&table);
+
+	return nodes;
+}
+
+uint64_t test_count(const char board[64], Player player)
+{
+	char copy[64];
+	COPY_BOARD(copy, board);
+	return count_valid_moves(copy, player, INITIAL_CASTLE, 0);
+}
+
+static void count_root_move(const Move move, const unsigned long long nodes, const double seconds, void* data)
+{
+	(void)move; (void)nodes; (void)seconds;
+	(*(unsigned int*)data)++;
+}
+
+// Returns the total, or the number of reported root moves when `root_moves` is set
+uint64_t test_divide(const char* fen, const int depth, unsigned int threads, const bool root_moves)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	unsigned int reported = 0;
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move)) return 0;
+
+	const uint64_t nodes = perft_divide(board, depth, player, castle, last_move, true, threads, count_root_move, &reported);
+	return root_moves ? reported : nodes;
+}
+
+// Perft positions 1 to 6, then en passant that can be taken and one that only looks like it
+static const char* TEST_FENS[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+	"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+	"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+};
+
+// The position of TEST_FENS[index] on the heap with its undo stack behind it, NULL when it can not be had
+static Position* test_position(const size_t index, Player* player, Castle* castle, Move* last_move)
+{
+	char board[64];
+	if (!parse_fen(TEST_FENS[index], board, player, castle, last_move)) return NULL;
+
+	Position* position = malloc(sizeof(Position) + MAX_PLY * sizeof(PositionUndo));
+	if (position == NULL) return NULL;
+
+	position_set(position, board, *player, *castle, *last_move);
+	position_set_history(position, (PositionUndo*)(position + 1), MAX_PLY);
+	return position;
+}
+
+// Moves a drained MoveGenerator returned, 0 when one was missed, returned twice or is not legal.
+// The hash move is a legal one or one of the other player, one killer is legal and the other one is stale
+uint64_t test_generator(const size_t index, const bool legal_hash_move)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(index, &player, &castle, &last_move);
+	if (position == NULL) return 0;
+
+	Move legal[MAX_VALID_MOVES], stale[MAX_VALID_MOVES];
+	unsigned char count = 0, stale_count = 0;
+	position_generate_valid_moves(position, legal, &count, player, castle, last_move);
+	position_generate_valid_moves(position, stale, &stale_count, SWITCH_PLAYER(player), castle, NO_MOVE);
+
+	Move killers[2] = { stale_count ? stale[stale_count - 1] : NO_MOVE, NO_MOVE };
+	for (unsigned char i = 0; i < count; i++)
+	{
+		if (GET_TYPE(legal[i]) == NORMAL && position->board[GET_TO(legal[i])] == ' ') killers[1] = legal[i];
+	}
+	const Move hash_move = legal_hash_move ? legal[count / 2] : stale_count ? stale[0] : CREATE_MOVE(0, 0, NORMAL, 0);
+
+	unsigned char seen[65536] = { 0 };
+	unsigned int returned = 0;
+	bool valid = true;
+
+	MoveGenerator generator;
+	move_generator_init(&generator, position, player, castle, last_move, hash_move, killers);
+	for (Move move; (move = move_generator_next(&generator)) != NO_MOVE; returned++)
+	{
+		if (seen[move]++ || !is_move_in_valid_moves(legal, count, move)) valid = false;
+	}
+	free(position);
+
+	return valid && returned == count ? returned : 0;
+}
+
+// True when every move of `part` is in `moves`
+static bool test_moves_within(Move part[MAX_VALID_MOVES], const unsigned char part_count, Move moves[MAX_VALID_MOVES], const unsigned char count)
+{
+	for (unsigned char i = 0; i < part_count; i++)
+	{
+		if (!is_move_in_valid_moves(moves, count, part[i])) return false;
+	}
+	return true;
+}
+
+// Captures and quiet moves split the legal moves when not in check, evasions are all of them in check and nothing otherwise
+static bool test_split_node(Position* position, const int depth, uint64_t* leaves, uint64_t* checks)
+{
+	const Player player = position->player;
+	const Move last_move = position_en_passant_move(position);
+	Move legal[MAX_VALID_MOVES], captures[MAX_VALID_MOVES], quiets[MAX_VALID_MOVES], evasions[MAX_VALID_MOVES];
+	unsigned char count, capture_count, quiet_count, evasion_count;
+
+	position_generate_valid_moves(position, legal, &count, player, position->castle, last_move);
+	position_generate_captures(position, captures, &capture_count, player, last_move);
+	position_generate_quiets(position, quiets, &quiet_count, player, position->castle);
+	position_generate_evasions(position, evasions, &evasion_count, player, last_move);
+
+	bool valid;
+	const bool in_check = position_is_in_check(position, player);
+	if (in_check)
+	{
+		valid = evasion_count == count && test_moves_within(legal, count, evasions, evasion_count);
+	}
+	else
+	{
+		Move both[MAX_VALID_MOVES];
+		memcpy(both, captures, capture_count * sizeof(Move));
+		memcpy(both + capture_count, quiets, quiet_count * sizeof(Move));
+
+		valid = evasion_count == 0 && capture_count + quiet_count == count &&
+		        test_moves_within(both, count, legal, count) && test_moves_within(legal, count, both, count);
+	}
+
+	if (depth == 0)
+	{
+		(*leaves)++;
+		*checks += in_check;
+		return valid;
+	}
+
+	for (unsigned char i = 0; i < count && valid; i++)
+	{
+		position_push(position, legal[i]);
+		valid = test_split_node(position, depth - 1, leaves, checks);
+		position_pop(position);
+	}
+	return valid;
+}
+
+// Positions `depth` plies below TEST_FENS[index], or the ones in check among them, 0 when a split went wrong on the way
+uint64_t test_generate_split(const size_t index, const int depth, const bool checks)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(index, &player, &castle, &last_move);
+	if (position == NULL) return 0;
+
+	uint64_t leaves = 0, in_check = 0;
+	const bool valid = test_split_node(position, depth, &leaves, &in_check);
+	free(position);
+
+	return valid ? checks ? in_check : leaves : 0;
+}
+
+// xorshift64, the random games are the same on every run
+static uint64_t test_random(uint64_t* state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// The incremental keys of `position` against position_hash and against a position set up from scratch
+static bool test_hash_matches(const Position* position)
+{
+	static Position fresh;
+	const Move last_move = position_en_passant_move(position);
+
+	position_set(&fresh, position->board, position->player, position->castle, last_move);
+	return position->key == fresh.key && position->hash == position_hash(position, position->player, position->castle, last_move);
+}
+
+// Plies of random games below TEST_FENS[index] whose keys matched, 0 when one did not or the root key changed after the pops
+uint64_t test_hash_walk(const size_t index, const int games, const int plies)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(index, &player, &castle, &last_move);
+	if (position == NULL) return 0;
+
+	const Bitboard root = position->hash;
+	uint64_t state = 0x9E3779B97F4A7C15ULL + index;
+	uint64_t checked = 0;
+	bool valid = test_hash_matches(position);
+
+	for (int game = 0; game < games && valid; game++)
+	{
+		for (int ply = 0; ply < plies && valid; ply++, checked++)
+		{
+			Move moves[MAX_VALID_MOVES];
+			unsigned char count;
+			position_legal_moves(position, moves, &count);
+			if (count == 0) break;
+
+			position_push(position, moves[test_random(&state) % count]);
+			valid = test_hash_matches(position);
+		}
+
+		while (position_pop(position) != NO_MOVE) {}
+		valid = valid && position->hash == root;
+	}
+	free(position);
+
+	return valid ? checked : 0;
+}
+
+// Plays space separated UCI moves, false when one is not legal or a key went wrong
+static bool test_play(Position* position, const char* moves)
+{
+	char uci[6];
+	while (*moves)
+	{
+		Move legal[MAX_VALID_MOVES];
+		unsigned char count;
+		position_legal_moves(position, legal, &count);
+
+		const size_t length = strcspn(moves, " ");
+		unsigned char i = 0;
+		while (i < count && (move_to_UCI(legal[i], uci), strlen(uci) != length || strncmp(uci, moves, length) != 0)) i++;
+		if (i == count) return false;
+
+		position_push(position, legal[i]);
+		if (!test_hash_matches(position)) return false;
+
+		moves += length;
+		while (*moves == ' ') moves++;
+	}
+	return true;
+}
+
+// 1 when both lines from the starting position reach the same key, 0 when they do not, 2 when a move or key went wrong
+uint64_t test_hash_transposition(const char* first, const char* second)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(0, &player, &castle, &last_move);
+	if (position == NULL) return 2;
+
+	Bitboard hashes[2] = { 0, 0 };
+	bool valid = test_play(position, first);
+	hashes[0] = position->hash;
+
+	while (position_pop(position) != NO_MOVE) {}
+	valid = valid && test_play(position, second);
+	hashes[1] = position->hash;
+	free(position);
+
+	return valid ? hashes[0] == hashes[1] : 2;
+}
+
+// Everything position_push changes and position_pop has to put back
+static bool test_same_position(const Position* a, const Position* b)
+{
+	return memcmp(a->board, b->board, sizeof(a->board)) == 0 && memcmp(a->pieces, b->pieces, sizeof(a->pieces)) == 0 &&
+	       memcmp(a->occupied, b->occupied, sizeof(a->occupied)) == 0 && memcmp(a->king_square, b->king_square, sizeof(a->king_square)) == 0 &&
+	       a->key == b->key && a->player == b->player && a->castle == b->castle && a->en_passant == b->en_passant &&
+	       a->halfmove_clock == b->halfmove_clock && a->hash == b->hash && a->ply == b->ply;
+}
+
+// Every move is popped back to the exact position it was pushed from and leaves the castle rights update_castle would
+static bool test_undo_node(Position* position, const int depth, uint64_t* leaves)
+{
+	if (depth == 0)
+	{
+		(*leaves)++;
+		return true;
+	}
+
+	Move moves[MAX_VALID_MOVES];
+	unsigned char count;
+	position_legal_moves(position, moves, &count);
+
+	const Position before = *position;
+	for (unsigned char i = 0; i < count; i++)
+	{
+		Castle castle = before.castle;
+
+		position_push(position, moves[i]);
+		update_castle(position->board, &castle);
+		const bool valid = castle == position->castle && test_undo_node(position, depth - 1, leaves);
+
+		if (position_pop(position) != moves[i] || !valid || !test_same_position(position, &before)) return false;
+	}
+	return true;
+}
+
+// Positions `depth` plies below TEST_FENS[index] when every push was undone exactly, 0 otherwise
+uint64_t test_push_pop(const size_t index, const int depth)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(index, &player, &castle, &last_move);
+	if (position == NULL) return 0;
+
+	uint64_t leaves = 0;
+	const bool valid = test_undo_node(position, depth, &leaves) && position->ply == 0 && position_pop(position) == NO_MOVE;
+	free(position);
+
+	return valid ? leaves : 0;
+}
+
+// Legal encodings of TEST_FENS[index] when is_legal_move agreed with the generated list on all 65536 of them, 0 otherwise.
+// Every castle value is tried with every last move: the real ones, rights the board does not allow, stray high bits,
+// no en passant and double pushes that never happened
+uint64_t test_legal_encodings(const size_t index)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	if (!parse_fen(TEST_FENS[index], board, &player, &castle, &last_move)) return 0;
+
+	const Castle castles[] = { castle, INITIAL_CASTLE, 0, 0x2A, 0xFF };
+	const Move last_moves[] = { last_move, NO_MOVE, CREATE_MOVE(11, 27, NORMAL, 0), CREATE_MOVE(52, 36, NORMAL, 0) };
+	uint64_t legal = 0;
+
+	for (size_t c = 0; c < sizeof(castles) / sizeof(castles[0]); c++)
+	{
+		for (size_t l = 0; l < sizeof(last_moves) / sizeof(last_moves[0]); l++)
+		{
+			Move moves[MAX_VALID_MOVES];
+			unsigned char count;
+			generate_valid_moves(board, moves, &count, BOTH, castles[c], last_moves[l]);
+
+			for (unsigned int move = 0; move <= 0xFFFF; move++)
+			{
+				const bool expected = is_move_in_valid_moves(moves, count, (Move)move);
+				if (is_legal_move(board, (Move)move, castles[c], last_moves[l]) != expected) return 0;
+				legal += expected;
+			}
+		}
+	}
+	return legal;
+}
+
+// Moves of the last ply that give check, false when position_gives_check or is_check_move disagreed with playing the move
+static bool test_check_node(Position* position, const int depth, uint64_t* checks)
+{
+	Move moves[MAX_VALID_MOVES];
+	unsigned char count;
+	CheckInfo info;
+	position_legal_moves(position, moves, &count);
+	position_check_info(position, position->player, &info);
+
+	for (unsigned char i = 0; i < count; i++)
+	{
+		const bool predicted = position_gives_check(position, &info, moves[i]);
+		if (is_check_move(position->board, moves[i]) != predicted) return false;
+
+		position_push(position, moves[i]);
+		const bool valid = position_is_in_check(position, position->player) == predicted &&
+		                   (depth == 1 ? (*checks += predicted, true) : test_check_node(position, depth - 1, checks));
+		position_pop(position);
+
+		if (!valid) return false;
+	}
+	return true;
+}
+
+// Checks given by the moves `depth` plies below TEST_FENS[index], 0 when a prediction was wrong on the way
+uint64_t test_gives_check(const size_t index, const int depth)
+{
+	Player player;
+	Castle castle;
+	Move last_move;
+	Position* position = test_position(index, &player, &castle, &last_move);
+	if (position == NULL) return 0;
+
+	uint64_t checks = 0;
+	const bool valid = test_check_node(position, depth, &checks);
+	free(position);
+
+	return valid ? checks : 0;
+}
+
+// Masks of every piece, empty squares and player of TEST_FENS[index] that match a plain square loop
+uint64_t test_board_masks(const size_t index)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	if (!parse_fen(TEST_FENS[index], board, &player, &castle, &last_move)) return 0;
+
+	const char pieces[] = "PNBRQKpnbrqk ";
+	uint64_t matched = 0;
+
+	for (const char* piece = pieces; *piece; piece++)
+	{
+		Bitboard expected = 0;
+		for (int square = 0; square < 64; square++)
+		{
+			if (board[square] == *piece) expected |= SQUARE_BB(square);
+		}
+		matched += board_piece_mask(board, *piece) == expected;
+	}
+
+	for (Player side = BLACK; side <= BOTH; side++)
+	{
+		Bitboard expected = 0;
+		for (int square = 0; square < 64; square++)
+		{
+			const bool owned = side == WHITE ? IS_WHITE_PIECE(board[square]) : side == BLACK ? IS_BLACK_PIECE(board[square]) : board[square] != ' ';
+			if (owned) expected |= SQUARE_BB(square);
+		}
+		matched += board_player_mask(board, side) == expected;
+	}
+
+	return matched;
+}
+
+// One column (offsetof a PerftStats field) of the row for `depth`
+uint64_t test_stats(const char* fen, const int depth, const size_t column)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	PerftStats stats[16];
+
+	if (depth < 1 || depth > 16 || !parse_fen(fen, board, &player, &castle, &last_move)) return 0;
+
+	perft_stats(board, depth, player, castle, last_move, true, stats);
+	return *(const unsigned long long*)((const char*)&stats[depth - 1] + column);
+}
+
+// A new empty file for `name`, unique to this run, false when it can not be created
+static bool test_temporary_file(char path[256], const char* name)
+{
+#ifdef TEST_POSIX_AVAILABLE
+	const char* directory = getenv("TMPDIR");
+	snprintf(path, 256, "%s/chess_test_%s_XXXXXX", directory != NULL && *directory ? directory : "/tmp", name);
+
+	const int fd = mkstemp(path);
+	if (fd < 0) return false;
+	close(fd);
+	return true;
+#else
+	// Exclusive creation ("x", C11) fails on a name another run already took
+	static unsigned int counter = 0;
+	for (int attempt = 0; attempt < 100; attempt++)
+	{
+		snprintf(path, 256, "chess_test_%s_%lld_%u.tmp", name, (long long)time(NULL), counter++);
+
+		FILE* file = fopen(path, "wx");
+		if (file != NULL)
+		{
+			fclose(file);
+			return true;
+		}
+	}
+	return false;
+#endif // TEST_POSIX_AVAILABLE
+}
+
+// Counts twice through a fresh table file, the second run only reads what the first one stored.
+// The first run switches players only when `first_switch` is set, the second one always does
+uint64_t test_hashed_file(const int depth, const bool hit_rate, const bool first_switch)
+{
+	char path[256];
+	PerftTable table;
+	uint64_t nodes = 0;
+
+	if (!test_temporary_file(path, "perft_table")) return 0;
+	for (int run = 0; run < 2; run++)
+	{
+		if (!perft_table_open(&table, path, 4))
+		{
+			nodes = 0;
+			break;
+		}
+
+		char copy[64];
+		COPY_BOARD(copy, INITIAL_BOARD);
+		nodes = perft_hashed(copy, depth, WHITE, INITIAL_CASTLE, 0, run == 1 || first_switch, &table);
+		if (run == 1 && hit_rate) nodes = (uint64_t)(perft_table_hit_rate(&table) * 100);
+
+		perft_table_free(&table);
+	}
+	remove(path);
+
+	return nodes;
+}
+
+// Runs a journaled perft, cuts the journal after `keep` lines plus half a line and resumes from it
+uint64_t test_journal(const int depth, const int keep, unsigned int threads)
+{
+	char path[256];
+	char lines[64][256];
+	int count = 0;
+	unsigned long long nodes = 0;
+
+	char copy[64];
+	COPY_BOARD(copy, INITIAL_BOARD);
+
+	if (!test_temporary_file(path, "perft_journal")) return 0;
+	if (!perft_journal(copy, depth, WHITE, INITIAL_CASTLE, 0, true, path, threads, 0, NULL, NULL, &nodes))
+	{
+		remove(path);
+		return 0;
+	}
+
+	FILE* file = fopen(path, "r");
+	if (file == NULL) return 0;
+	while (count < keep && count < 64 && fgets(lines[count], sizeof(lines[count]), file) != NULL) count++;
+	fclose(file);
+
+	file = fopen(path, "w");
+	if (file == NULL) return 0;
+	for (int i = 0; i < count; i++) fputs(lines[i], file);
+	fputs("1", file); // interrupted in the middle of a record
+	fclose(file);
+
+	nodes = 0;
+	if (!perft_journal(copy, depth, WHITE, INITIAL_CASTLE, 0, true, path, threads, 0, NULL, NULL, &nodes)) nodes = 0;
+	remove(path);
+
+	return nodes;
+}
+
+// Nodes of a frontier perft, or the distinct frontier positions it counted from
+uint64_t test_frontier(const char* fen, const int depth, unsigned int frontier_ply, const size_t megabytes, const bool positions)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	PerftFrontierStats stats;
+	unsigned long long nodes;
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move)) return 0;
+	if (!perft_frontier(board, depth, player, castle, last_move, true, frontier_ply, 0, megabytes, &stats, &nodes)) return 0;
+
+	return positions ? stats.positions : nodes;
+}
+
+// 1 when a search of `depth` plies picks the `expected` UCI move
+uint64_t test_search(const char* fen, const int depth, const char* expected)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	char uci[6];
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move)) return 0;
+
+	const SearchLimits limits = { .depth = depth };
+	move_to_UCI(search_best_move(board, player, castle, last_move, &limits, NULL, NULL), uci);
+
+	return strcmp(uci, expected) == 0;
+}
+
+// Nodes a search of the starting position visited under a node limit
+uint64_t test_search_nodes(const unsigned long long nodes)
+{
+	char board[64];
+	COPY_BOARD(board, INITIAL_BOARD);
+
+	SearchResult result;
+	const SearchLimits limits = { .nodes = nodes };
+	if (search_best_move(board, WHITE, INITIAL_CASTLE, NO_MOVE, &limits, NULL, &result) == NO_MOVE) return 0;
+
+	return result.nodes;
+}
+
+// 1 when a Lazy SMP search on `threads` threads completes `depth` plies and picks the `expected` UCI move
+uint64_t test_search_threads(const char* fen, const int depth, const unsigned int threads, const char* expected)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	SearchResult result;
+	SearchTable table;
+	char uci[6];
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move) || !search_table_init(&table, 16)) return 0;
+
+	const SearchLimits limits = { .depth = depth, .threads = threads };
+	move_to_UCI(search_best_move(board, player, castle, last_move, &limits, &table, &result), uci);
+	search_table_free(&table);
+
+	return result.depth >= depth && strcmp(uci, expected) == 0;
+}
+
+// Percent of the nodes a search of `depth` plies still needs with a transposition table, 0 when the best move changed
+uint64_t test_search_table(const char* fen, const int depth)
+{
+	char board[64];
+	Player player;
+	Castle castle;
+	Move last_move;
+	SearchResult plain, hashed;
+	SearchTable table;
+
+	if (!parse_fen(fen, board, &player, &castle, &last_move)) return 0;
+	if (!search_table_init(&table, 1) || !search_table_resize(&table, 16)) return 0;
+
+	const SearchLimits limits = { .depth = depth };
+	search_best_move(board, player, castle, last_move, &limits, NULL, &plain);
+	search_best_move(board, player, castle, last_move, &limits, &table, &hashed);
+	search_table_free(&table);
+
+	return hashed.best_move == plain.best_move ? hashed.nodes * 100 / plain.nodes : 0;
+}
+
 // Define unit tests
 void test_perft_init_position() {
 	assert_equal(test_initial_position(1, WHITE), 20);
@@ -255,6 +944,198 @@ void test_perft_knight()
 #endif
 }
 
+void test_perft_parallel()
+{
+	assert_equal(test_parallel_initial_position(1, WHITE, 4, 2), 20);
+	assert_equal(test_parallel_initial_position(3, WHITE, 4, 2), 8902);
+	assert_equal(test_parallel_initial_position(4, WHITE, 3, 3), 197281);
+	assert_equal(test_parallel_initial_position(5, WHITE, 0, 0), 4865609);
+	assert_equal(test_parallel_knight(8, WHITE, 4, 3), 517796);
+#ifdef ALL_TESTS
+	assert_equal(test_parallel_initial_position(6, WHITE, 0, 3), 119060324);
+#endif
+}
+
+void test_perft_hashed()
+{
+	const char knight[64] = {
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', 'N',
+	};
+
+	assert_equal(test_hashed(INITIAL_BOARD, 3, WHITE, true), 8902);
+	assert_equal(test_hashed(INITIAL_BOARD, 5, WHITE, true), 4865609);
+	assert_equal(test_hashed(knight, 10, WHITE, false), 18678652);
+	assert_equal(test_hashed_mixed("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4), 4085603);
+#ifdef TEST_MMAP_AVAILABLE
+	assert_equal(test_hashed_file(5, false, true), 4865609);
+	assert_equal(test_hashed_file(5, true, true), 100); // the root is already stored
+	assert_equal(test_hashed_file(5, false, false), 4865609); // counts without switching players are kept apart
+#endif // TEST_MMAP_AVAILABLE
+#ifdef ALL_TESTS
+	assert_equal(test_hashed(INITIAL_BOARD, 7, WHITE, true), 3195901860);
+#endif
+}
+
+void test_count_valid_moves()
+{
+	assert_equal(test_count(INITIAL_BOARD, WHITE), 20);
+	assert_equal(test_count(INITIAL_BOARD, BLACK), 20);
+	assert_equal(test_count(INITIAL_BOARD, BOTH), 40);
+}
+
+void test_perft_journal()
+{
+	assert_equal(test_journal(4, 1, 1), 197281);  // only the header survived
+	assert_equal(test_journal(4, 40, 1), 197281);
+	assert_equal(test_journal(5, 64, 4), 4865609);
+}
+
+void test_perft_frontier()
+{
+	const char* initial = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+	const char* kiwipete = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+
+	assert_equal(test_frontier(initial, 5, 4, 64, true), 72078); // distinct positions after 4 plies
+	assert_equal(test_frontier(initial, 5, 4, 64, false), 4865609);
+	assert_equal(test_frontier(initial, 5, 4, 1, false), 4865609); // spilled to disk
+	assert_equal(test_frontier(kiwipete, 4, 2, 1, false), 4085603);
+	assert_equal(test_frontier("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 5, 3, 1, false), 16422290); // en passant
+#ifdef ALL_TESTS
+	assert_equal(test_frontier(initial, 7, 5, 512, false), 3195901860);
+#endif
+}
+
+void test_search_best_move()
+{
+	assert_equal(test_search("6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1", 3, "a1a8"), 1);                // back rank mate
+	assert_equal(test_search("4k3/8/8/3q4/8/8/8/3RK3 w - - 0 1", 4, "d1d5"), 1);                     // hanging queen
+	assert_equal(test_search("2r3k1/p4p2/3Rp2p/1p2P1pK/8/1P4P1/P3Q2P/1q6 b - - 0 1", 6, "b1g6"), 1); // mate in 3
+	assert_equal(test_search("4k3/8/2p5/3r4/n7/8/8/3QK3 w - - 0 1", 1, "d1a4"), 1);                  // the rook is defended, quiescence sees c6xd5
+	assert_equal(test_search_nodes(10000), 10000);
+	assert_equal(test_search_table("6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1", 3), 100); // found by the first iteration
+	assert_equal(test_search_threads("2r3k1/p4p2/3Rp2p/1p2P1pK/8/1P4P1/P3Q2P/1q6 b - - 0 1", 5, 4, "b1g6"), 1);
+	assert_equal(test_search_threads("4k3/8/8/3q4/8/8/8/3RK3 w - - 0 1", 6, 8, "d1d5"), 1);
+	assert_equal(test_search_table("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 9) < 50, 1); // transpositions of the endgame
+}
+
+void test_move_generator()
+{
+	const uint64_t counts[] = { 20, 48, 14, 6, 44, 46, 31, 20 };
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		assert_equal(test_generator(i, true), counts[i]);
+		assert_equal(test_generator(i, false), counts[i]);
+	}
+}
+
+void test_generate_stages()
+{
+	assert_equal(test_generate_split(0, 3, false), 8902);
+	assert_equal(test_generate_split(0, 3, true), 12);
+	assert_equal(test_generate_split(1, 2, false), 2039);
+	assert_equal(test_generate_split(1, 2, true), 3);
+	assert_equal(test_generate_split(2, 3, true), 267);
+	assert_equal(test_generate_split(3, 2, true), 10);
+	assert_equal(test_generate_split(4, 2, false), 1486);
+	assert_equal(test_generate_split(5, 2, false), 2079);
+	assert_equal(test_generate_split(6, 2, false), 707);
+	assert_equal(test_generate_split(7, 3, false), 13160);
+}
+
+void test_position_hash()
+{
+	assert_equal(test_hash_walk(0, 20, 200), 3687);
+	assert_equal(test_hash_walk(1, 20, 200), 3595);
+	assert_equal(test_hash_walk(3, 20, 200), 3470);
+	assert_equal(test_hash_walk(6, 20, 200), 3917);
+	assert_equal(test_hash_transposition("e2e4 e7e5 g1f3", "g1f3 e7e5 e2e4"), 1); // e3 can not be taken
+	assert_equal(test_hash_transposition("g1f3 g8f6 f3g1 f6g8", "b1c3 b8c6 c3b1 c6b8"), 1);
+	assert_equal(test_hash_transposition("e2e4 a7a6 e4e5 d7d5", "e2e4 a7a6 e4e5 d7d5 g1f3 b8c6 f3g1 c6b8"), 0); // e5xd6 is gone
+	assert_equal(test_hash_transposition("e2e4 e7e5 e1e2 e8e7 e2e1 e7e8", "e2e4 e7e5"), 0); // castle rights are gone
+}
+
+void test_position_push_pop()
+{
+	assert_equal(test_push_pop(1, 3), 97862);  // castling, rook moves and rook captures
+	assert_equal(test_push_pop(3, 3), 9467);   // promotions that take rooks
+	assert_equal(test_push_pop(4, 3), 62379);
+	assert_equal(test_push_pop(6, 3), 21637);  // en passant
+}
+
+void test_legal_move()
+{
+	const uint64_t legal[] = { 800, 1792, 616, 1032, 1552, 1856, 1090, 1000 }; // both players, 20 castle and last move variants
+
+	for (size_t i = 0; i < sizeof(legal) / sizeof(legal[0]); i++)
+	{
+		assert_equal(test_legal_encodings(i), legal[i]);
+	}
+}
+
+void test_check_moves()
+{
+	assert_equal(test_gives_check(0, 4), 469);
+	assert_equal(test_gives_check(1, 3), 993);
+	assert_equal(test_gives_check(2, 4), 1680);
+	assert_equal(test_gives_check(3, 3), 38);
+	assert_equal(test_gives_check(4, 2), 117);
+	assert_equal(test_gives_check(5, 2), 40);
+	assert_equal(test_gives_check(6, 3), 1168); // en passant
+}
+
+void test_board_scan()
+{
+	for (size_t i = 0; i < sizeof(TEST_FENS) / sizeof(TEST_FENS[0]); i++)
+	{
+		assert_equal(test_board_masks(i), 16); // 12 pieces, empty squares and 3 players
+	}
+}
+
+void test_perft_divide()
+{
+	const char* kiwipete = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+
+	assert_equal(test_divide(kiwipete, 1, 1, true), 48);
+	assert_equal(test_divide(kiwipete, 3, 1, false), 97862);
+	assert_equal(test_divide(kiwipete, 4, 0, false), 4085603);
+	assert_equal(test_divide("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4, false), 4865609);
+	assert_equal(test_divide("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 0, false), 674624);
+	assert_equal(test_divide("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 0, false), 422333);
+}
+
+void test_perft_stats()
+{
+	const char* initial = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+	const char* kiwipete = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+	const char* position_3 = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1";
+
+	assert_equal(test_stats(initial, 4, offsetof(PerftStats, checks)), 469);
+	assert_equal(test_stats(initial, 4, offsetof(PerftStats, checkmates)), 8);
+	assert_equal(test_stats(kiwipete, 3, offsetof(PerftStats, captures)), 17102);
+	assert_equal(test_stats(kiwipete, 3, offsetof(PerftStats, en_passants)), 45);
+	assert_equal(test_stats(kiwipete, 3, offsetof(PerftStats, castles)), 3162);
+	assert_equal(test_stats(kiwipete, 3, offsetof(PerftStats, checkmates)), 1);
+	assert_equal(test_stats(kiwipete, 4, offsetof(PerftStats, promotions)), 15172);
+	assert_equal(test_stats(kiwipete, 4, offsetof(PerftStats, discovered_checks)), 42);
+	assert_equal(test_stats(kiwipete, 4, offsetof(PerftStats, double_checks)), 6);
+	assert_equal(test_stats(position_3, 5, offsetof(PerftStats, checks)), 52950);
+	assert_equal(test_stats(position_3, 5, offsetof(PerftStats, discovered_checks)), 1292);
+	assert_equal(test_stats(position_3, 5, offsetof(PerftStats, double_checks)), 3);
+#ifdef ALL_TESTS
+	assert_equal(test_stats(initial, 5, offsetof(PerftStats, en_passants)), 258);
+	assert_equal(test_stats(initial, 5, offsetof(PerftStats, checkmates)), 347);
+	assert_equal(test_stats(position_3, 6, offsetof(PerftStats, checkmates)), 2733);
+#endif
+}
+
 void run_tests() {
 	// Run each test
 	test_perft_init_position();  // Initial Position
@@ -269,5 +1150,21 @@ void run_tests() {
 
 	test_perft_knight();		 // Knight tests
 
+	test_perft_parallel();		 // Same counts from perft_parallel
+	test_perft_hashed();		 // Same counts from perft_hashed
+	test_count_valid_moves();	 // Bulk counting without a move list
+	test_move_generator();		 // Every legal move once from the staged generator
+	test_generate_stages();		 // Captures, quiet moves and evasions against the legal moves
+	test_position_hash();		 // Incremental Zobrist keys against keys computed from scratch
+	test_position_push_pop();	 // Undo records and castle rights of position_push/position_pop
+	test_legal_move();			 // is_legal_move against the generated moves for every encoding
+	test_check_moves();			 // position_gives_check against playing the move
+	test_board_scan();			 // Vector board scans against a square loop, for the kernel of this build
+	test_perft_divide();		 // Per root move counts from FEN positions
+	test_perft_stats();			 // Captures, checks, mates... per ply
+	test_perft_journal();		 // Resumed from a cut off journal
+	test_perft_frontier();		 // Transpositions merged breadth-first
+	test_search_best_move();	 // Mates and material found by the alpha-beta search
+
 	printf("Testing process finished.\n");
 }